@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Minimal microbenchmark harness: every case is warmed up, then timed as a
+// number of samples. Cheap operations are batched so that one sample is long
+// enough for the clock, and results are reported per operation.
+class Bench{
+private:
+    struct Result{
+        std::string name;
+        size_t      batch;
+        double      min, median, p90, p99;
+    };
+
+    using bench_clock=std::chrono::steady_clock;
+
+    int                 warmup;
+    int                 samples;
+    std::string         filter;
+    std::vector<Result> results;
+
+    static double percentile(const std::vector<double>& sorted, double p)
+    {
+        size_t index=static_cast<size_t>(p*(sorted.size()-1)+0.5);
+        return sorted[std::min(index, sorted.size()-1)];
+    }
+
+    bool skip(const std::string& name) const
+    {
+        return !filter.empty() && name.find(filter)==std::string::npos;
+    }
+
+    void record(const std::string& name, size_t batch, std::vector<double>& times)
+    {
+        std::sort(times.begin(), times.end());
+        Result result{name, batch, times.front(), percentile(times, 0.5), percentile(times, 0.9), percentile(times, 0.99)};
+        printf("%-44s %10.1f %10.1f %10.1f %10.1f\n", name.c_str(), result.min, result.median, result.p90, result.p99);
+        results.push_back(result);
+    }
+
+public:
+    Bench(int warmup=10, int samples=50, std::string filter="")
+    : warmup(warmup), samples(samples), filter(std::move(filter))
+    {
+        printf("%-44s %10s %10s %10s %10s\n", "benchmark (ns/op)", "min", "median", "p90", "p99");
+    }
+
+    // times f(), batching calls until a sample takes at least 200us
+    template<typename F>
+    void run(const std::string& name, F&& f)
+    {
+        if(skip(name))
+            return;
+
+        for(int i=0; i<warmup; i++)
+            f();
+
+        size_t batch=1;
+        for(;;){
+            auto start=bench_clock::now();
+            for(size_t i=0; i<batch; i++)
+                f();
+            if(bench_clock::now()-start>=std::chrono::microseconds(200) || batch>=(1u<<24))
+                break;
+            batch*=2;
+        }
+
+        std::vector<double> times;
+        for(int s=0; s<samples; s++){
+            auto start=bench_clock::now();
+            for(size_t i=0; i<batch; i++)
+                f();
+            auto end=bench_clock::now();
+            times.push_back(std::chrono::duration<double, std::nano>(end-start).count()/batch);
+        }
+        record(name, batch, times);
+    }
+
+    // times f() once per sample, with an untimed setup() before each call
+    template<typename S, typename F>
+    void run(const std::string& name, S&& setup, F&& f)
+    {
+        if(skip(name))
+            return;
+
+        for(int i=0; i<warmup; i++){
+            setup();
+            f();
+        }
+
+        std::vector<double> times;
+        for(int s=0; s<samples; s++){
+            setup();
+            auto start=bench_clock::now();
+            f();
+            auto end=bench_clock::now();
+            times.push_back(std::chrono::duration<double, std::nano>(end-start).count());
+        }
+        record(name, 1, times);
+    }
+
+    bool writeCsv(const std::string& path) const
+    {
+        FILE* file=fopen(path.c_str(), "w");
+        if(file==nullptr)
+            return false;
+
+        fprintf(file, "name,batch,min_ns,median_ns,p90_ns,p99_ns\n");
+        for(const auto& r: results)
+            fprintf(file, "%s,%zu,%.1f,%.1f,%.1f,%.1f\n", r.name.c_str(), r.batch, r.min, r.median, r.p90, r.p99);
+        fclose(file);
+        return true;
+    }
+};
+
+// keeps the compiler from discarding a computed value
+template<typename T>
+inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
@@ -0,0 +1,401 @@
+// Microbenchmarks for the rasterization hot paths. All inputs are generated
+// procedurally, so no asset files are needed.
+//
+//   rasterizer_bench [--filter substring] [--warmup N] [--samples N] [--csv path]
+
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Bench.hpp"
+#include "Geometry.hpp"
+#include "RenderContext.hpp"
+
+// uv sphere of radius 1 with (segments+1)*(rings+1) vertices
+static Model makeSphere(int segments, int rings)
+{
+    tinyobj::attrib_t attrib;
+    tinyobj::shape_t shape;
+
+    for(int i=0; i<=rings; i++){
+        float theta=M_PI*i/rings;
+        for(int j=0; j<=segments; j++){
+            float phi=2*M_PI*j/segments;
+            float x=std::sin(theta)*std::cos(phi);
+            float y=std::cos(theta);
+            float z=std::sin(theta)*std::sin(phi);
+            attrib.vertices.insert(attrib.vertices.end(), {x, y, z});
+            attrib.normals.insert(attrib.normals.end(), {x, y, z});
+            attrib.colors.insert(attrib.colors.end(), {1.f, 1.f, 1.f});
+            attrib.texcoords.insert(attrib.texcoords.end(), {float(j)/segments, 1.f-float(i)/rings});
+        }
+    }
+
+    auto corner=[&](int i, int j){
+        int index=i*(segments+1)+j;
+        return tinyobj::index_t{index, index, index};
+    };
+    for(int i=0; i<rings; i++){
+        for(int j=0; j<segments; j++){
+            shape.mesh.indices.insert(shape.mesh.indices.end(), {corner(i, j), corner(i, j+1), corner(i+1, j+1)});
+            shape.mesh.indices.insert(shape.mesh.indices.end(), {corner(i, j), corner(i+1, j+1), corner(i+1, j)});
+            shape.mesh.num_face_vertices.insert(shape.mesh.num_face_vertices.end(), {3, 3});
+            shape.mesh.material_ids.insert(shape.mesh.material_ids.end(), {-1, -1});
+        }
+    }
+
+    return Model(attrib, {shape});
+}
+
+static Texture* makeChecker(int size, TextureFormat format=TextureFormat::RGBA8)
+{
+    std::vector<color_t> data(size*size);
+    for(int y=0; y<size; y++)
+        for(int x=0; x<size; x++)
+            data[y*size+x]=((x/32+y/32)%2) ? color_t(1.f, .25f, .25f) : color_t(.25f, .25f, 1.f);
+    return new Texture(size, size, std::move(data), TextureType::DIFFUSE, format);
+}
+
+// front-facing triangle inscribed in a circle, optionally stretched into a sliver
+static triangle_t makeTriangle(float cx, float cy, float size, float angle, float stretch=1.f)
+{
+    triangle_t triangle;
+    for(int i=0; i<3; i++){
+        float a=angle+i*2*M_PI/3;
+        float x=std::cos(a)*size/2*stretch;
+        float y=std::sin(a)*size/2/stretch;
+        triangle.vertices[i]=vertex_t(cx+x, cy+y, 0.5f);
+        triangle.normals[i]=normal_t(0.f, 0.f, 1.f);
+        triangle.colors[i]=color_t(1.f, 1.f, 1.f);
+    }
+    triangle.texcoords={texcoord_t(0.f, 0.f), texcoord_t(1.f, 0.f), texcoord_t(0.f, 1.f)};
+
+    if(Rasterizer::isTriangleBackface(triangle))
+        std::swap(triangle.vertices[1], triangle.vertices[2]);
+    return triangle;
+}
+
+static void benchClear(Bench& bench)
+{
+    Rasterizer rasterizer(SCR_WIDTH, SCR_HEIGHT);
+    bench.run("Rasterizer::clear 1920x1080", [&]{
+        rasterizer.clear({1.f, 1.f, 1.f});
+        doNotOptimize(rasterizer.getColorTarget());
+    });
+}
+
+static void benchTriangles(Bench& bench)
+{
+    Rasterizer rasterizer(SCR_WIDTH, SCR_HEIGHT);
+    ShaderInfo shader_info;
+    shader_info.view_pos=direct_t(0.f, 0.f, 10.f);
+    shader_info.ambient=vec3f_t(.1f, .1f, .1f);
+    shader_info.diffuse=vec3f_t(.8f, .8f, .8f);
+    shader_info.specular=vec3f_t(.5f, .5f, .5f);
+
+    struct Orientation{
+        const char* name;
+        float       angle;
+        float       stretch;
+    };
+    const Orientation orientations[]={
+        {"upright", float(M_PI/2), 1.f},
+        {"rotated", 0.3f, 1.f},
+        {"sliver", 0.1f, 6.f},
+    };
+
+    for(float size: {4.f, 16.f, 64.f, 256.f, 1024.f}){
+        for(const auto& orientation: orientations){
+            triangle_t triangle=makeTriangle(960.f, 540.f, size, orientation.angle, orientation.stretch);
+            std::string name="Rasterizer::drawTriangle "+std::to_string(int(size))+"px "+orientation.name;
+            rasterizer.clear();
+            bench.run(name, [&]{
+                rasterizer.drawTriangle(triangle, shader_info);
+            });
+        }
+    }
+
+    // same triangles through the vertex-color Phong program
+    for(float size: {64.f, 256.f}){
+        triangle_t triangle=makeTriangle(960.f, 540.f, size, float(M_PI/2));
+        rasterizer.clear();
+        bench.run("Rasterizer::drawTriangle<PhongProgram> "+std::to_string(int(size))+"px upright", [&]{
+            rasterizer.drawTriangle<PhongProgram>(triangle, shader_info);
+        });
+    }
+}
+
+static void benchLines(Bench& bench)
+{
+    Rasterizer rasterizer(SCR_WIDTH, SCR_HEIGHT);
+    const std::pair<const char*, line_t> lines[]={
+        {"horizontal", line_t{vertex_t(100.f, 540.f, 0.f), vertex_t(1800.f, 540.f, 0.f)}},
+        {"diagonal", line_t{vertex_t(100.f, 100.f, 0.f), vertex_t(1000.f, 1000.f, 0.f)}},
+        {"steep", line_t{vertex_t(960.f, 20.f, 0.f), vertex_t(1000.f, 1060.f, 0.f)}},
+    };
+
+    for(const auto& [name, line]: lines)
+        bench.run(std::string("Rasterizer::drawLine ")+name, [&]{
+            rasterizer.drawLine(line, {1.f, 0.f, 0.f});
+        });
+}
+
+static void benchTransform(Bench& bench)
+{
+    for(int segments: {32, 128, 512}){
+        Model model=makeSphere(segments, segments/2);
+        Shader shader;
+        shader.bind(&model);
+
+        matrix_t mat=Geometry::rotate(matrix_t::Identity(), 0.5f, direct_t(0.f, 1.f, 0.f));
+        shader.setModel(mat);
+
+        int vertices=(segments+1)*(segments/2+1);
+        bench.run("Shader::transform "+std::to_string(vertices)+" vertices",
+            [&]{ shader.flush(); },
+            [&]{ shader.transform(); });
+
+        // through the render benchmark's camera, meshlets that face away or
+        // are off screen close up skip the transform
+        Camera camera(direct_t(0.f, 0.f, 3.f));
+        shader.setProjection(Geometry::viewport(0.f, 0.f, SCR_WIDTH, SCR_HEIGHT, 0.f, 1.f)*camera.getProjection());
+        shader.setLodError(0.f);
+        shader.setView(camera.getView());
+        bench.run("Shader::transform "+std::to_string(vertices)+" vertices in view",
+            [&]{ shader.flush(); },
+            [&]{ shader.transform(); });
+        shader.setView(Geometry::lookAt(vec3f_t(0.f, 0.f, 1.6f), vec3f_t(.8f, .3f, 0.f), vec3f_t(0.f, 1.f, 0.f)));
+        bench.run("Shader::transform "+std::to_string(vertices)+" vertices close up",
+            [&]{ shader.flush(); },
+            [&]{ shader.transform(); });
+    }
+}
+
+static void benchSample(Bench& bench)
+{
+    Texture* texture=makeChecker(1024);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
+    std::vector<texcoord_t> random(4096);
+    for(auto& uv: random)
+        uv=texcoord_t(dist(rng), dist(rng));
+
+    size_t i=0;
+    bench.run("Texture::sample random", [&]{
+        const auto& uv=random[i++%random.size()];
+        doNotOptimize(texture->sample(uv.x(), uv.y()));
+    });
+
+    float u=0.f;
+    bench.run("Texture::sample coherent", [&]{
+        u+=1.f/4096;
+        if(u>=1.f)
+            u=0.f;
+        doNotOptimize(texture->sample(u, 0.5f));
+    });
+
+    // minified surface, one pixel step covers 8 texels
+    const vec2f_t duv_dx(8.f/1024, 0.f), duv_dy(0.f, 8.f/1024);
+    bench.run("Texture::sample trilinear minified", [&]{
+        const auto& uv=random[i++%random.size()];
+        doNotOptimize(texture->sample(uv, duv_dx, duv_dy));
+    });
+
+    for(auto [name, format]: {std::pair{"bc1", TextureFormat::BC1}, {"bc3", TextureFormat::BC3}}){
+        Texture* compressed=makeChecker(1024, format);
+        bench.run(std::string("Texture::sample trilinear minified ")+name, [&]{
+            const auto& uv=random[i++%random.size()];
+            doNotOptimize(compressed->sample(uv, duv_dx, duv_dy));
+        });
+        bench.run(std::string("Texture::sample coherent ")+name, [&]{
+            u+=1.f/4096;
+            if(u>=1.f)
+                u=0.f;
+            doNotOptimize(compressed->sample(u, 0.5f));
+        });
+        delete compressed;
+    }
+
+    delete texture;
+}
+
+static void benchRender(Bench& bench)
+{
+    Camera camera(direct_t(0.f, 0.f, 3.f));
+    RenderContext context(SCR_WIDTH, SCR_HEIGHT);
+    Rasterizer& rasterizer=context.getRasterizer();
+    Shader& shader=context.getShader();
+    TextureHandle texture(makeChecker(1024));
+
+    matrix_t viewport=Geometry::viewport(0.f, 0.f, SCR_WIDTH, SCR_HEIGHT, 0.f, 1.f);
+    shader.setView(camera.getView());
+    shader.setProjection(viewport*camera.getProjection());
+    context.bind(&camera);
+
+    for(int segments: {64, 256}){
+        Model model=makeSphere(segments, segments/2);
+        model.setTextures({{"checker", texture}});
+
+        context.clearScene();
+        context.add(model, Geometry::rotate(matrix_t::Identity(), 0.5f, direct_t(0.f, 1.f, 0.f)));
+
+        bench.run("RenderContext::render sphere "+std::to_string(segments*segments)+" triangles",
+            [&]{ context.clear({1.f, 1.f, 1.f}); },
+            [&]{ context.render(); });
+
+        // same frame multisampled, including the resolve
+        for(int samples: {4, 8}){
+            rasterizer.setSampleCount(samples);
+            bench.run("RenderContext::render sphere "+std::to_string(segments*segments)+" triangles msaa "+std::to_string(samples)+"x",
+                [&]{ context.clear({1.f, 1.f, 1.f}); },
+                [&]{ context.render(); });
+        }
+        rasterizer.setSampleCount(1);
+
+        // small point lights on a shell around the sphere, each tile only
+        // shades with the few that reach it
+        std::vector<light_t> lights;
+        std::mt19937 rng(7);
+        std::normal_distribution<float> normal;
+        for(int i=0; i<256; i++){
+            vec3f_t position=vec3f_t(normal(rng), normal(rng), normal(rng)).normalized()*1.2f;
+            lights.push_back({position, vec3f_t(.05f, .05f, .05f), .5f});
+        }
+        shader.setLights(lights);
+        bench.run("RenderContext::render sphere "+std::to_string(segments*segments)+" triangles 256 lights",
+            [&]{ context.clear({1.f, 1.f, 1.f}); },
+            [&]{ context.render(); });
+        shader.setLights({});
+
+        // depth-only pass of the same sphere from a light, the map covers
+        // about as many pixels as the frame
+        ShadowMap shadow_map(1440);
+        shadow_map.setLight(Geometry::lookAt(vec3f_t(0.f, 1.f, 3.f), vec3f_t::Zero(), vec3f_t(0.f, 1.f, 0.f)),
+            Geometry::perspective(45.f, 1.f, 1.f, 10.f));
+        bench.run("RenderContext::renderShadow sphere "+std::to_string(segments*segments)+" triangles 1440x1440",
+            [&]{ context.renderShadow(shadow_map); });
+
+        // close up on the rim, most meshlets are off screen or face away
+        // and none of their vertices get transformed
+        shader.setView(Geometry::lookAt(vec3f_t(0.f, 0.f, 1.6f), vec3f_t(.8f, .3f, 0.f), vec3f_t(0.f, 1.f, 0.f)));
+        bench.run("RenderContext::render sphere "+std::to_string(segments*segments)+" triangles close up",
+            [&]{ context.clear({1.f, 1.f, 1.f}); },
+            [&]{ context.render(); });
+        shader.setView(camera.getView());
+    }
+}
+
+static void benchInstances(Bench& bench)
+{
+    Camera camera(direct_t(0.f, 12.f, 30.f));
+    RenderContext context(SCR_WIDTH, SCR_HEIGHT);
+    Shader& shader=context.getShader();
+    Model model=makeSphere(32, 16);
+
+    matrix_t viewport=Geometry::viewport(0.f, 0.f, SCR_WIDTH, SCR_HEIGHT, 0.f, 1.f);
+    shader.setView(Geometry::lookAt(vec3f_t(0.f, 12.f, 30.f), vec3f_t::Zero(), vec3f_t(0.f, 1.f, 0.f)));
+    shader.setProjection(viewport*camera.getProjection());
+    context.bind(&camera);
+
+    // 32x32 grid, about half of it in view
+    std::vector<Instance> instances;
+    for(int z=0; z<32; z++)
+        for(int x=0; x<32; x++)
+            instances.push_back({Geometry::translate(matrix_t::Identity(), vec3f_t((x-16)*3.f, 0.f, (z-24)*3.f))});
+
+    context.add(model, instances);
+    bench.run("RenderContext::render 1024 sphere instances",
+        [&]{ context.clear({1.f, 1.f, 1.f}); },
+        [&]{ context.render(); });
+
+    // the far copies cover a few dozen pixels, levels of detail halve them
+    shader.setLodError(0.f);
+    bench.run("RenderContext::render 1024 sphere instances full detail",
+        [&]{ context.clear({1.f, 1.f, 1.f}); },
+        [&]{ context.render(); });
+    shader.setLodError(1.f);
+
+    // the same copies as one scene object each
+    context.clearScene();
+    for(const Instance& instance: instances)
+        context.add(model, instance.model_mat);
+    bench.run("RenderContext::render 1024 sphere objects",
+        [&]{ context.clear({1.f, 1.f, 1.f}); },
+        [&]{ context.render(); });
+}
+
+static void benchContexts(Bench& bench)
+{
+    // four views around one shared sphere, as for a batch of thumbnails
+    constexpr int VIEWS=4;
+    constexpr int SIZE=256;
+    Model model=makeSphere(128, 64);
+    matrix_t viewport=Geometry::viewport(0.f, 0.f, SIZE, SIZE, 0.f, 1.f);
+
+    std::vector<std::unique_ptr<RenderContext>> contexts;
+    for(int k=0; k<VIEWS; k++){
+        auto context=std::make_unique<RenderContext>(SIZE, SIZE);
+        float angle=2.f*float(M_PI)*k/VIEWS;
+        vec3f_t eye(3.f*std::sin(angle), 1.f, 3.f*std::cos(angle));
+        context->getShader().setView(Geometry::lookAt(eye, vec3f_t::Zero(), vec3f_t(0.f, 1.f, 0.f)));
+        context->getShader().setProjection(viewport*Geometry::perspective(45.f, 1.f, 0.1f, 100.f));
+        context->add(model);
+        contexts.push_back(std::move(context));
+    }
+
+    auto clear=[&]{
+        for(auto& context: contexts)
+            context->clear({1.f, 1.f, 1.f});
+    };
+    bench.run("RenderContext::render 4 views 256x256 one after another", clear, [&]{
+        for(auto& context: contexts)
+            context->render();
+    });
+    // each view on its own thread, the contexts' inner loops stay serial
+    bench.run("RenderContext::render 4 views 256x256 concurrent", clear, [&]{
+#pragma omp parallel for num_threads(VIEWS)
+        for(int k=0; k<VIEWS; k++)
+            contexts[k]->render();
+    });
+}
+
+int main(int argc, const char* argv[])
+{
+    std::string filter, csv;
+    int warmup=10, samples=50;
+    for(int i=1; i<argc; i++){
+        std::string arg=argv[i];
+        if(arg=="--filter" && i+1<argc)
+            filter=argv[++i];
+        else if(arg=="--warmup" && i+1<argc)
+            warmup=std::stoi(argv[++i]);
+        else if(arg=="--samples" && i+1<argc)
+            samples=std::stoi(argv[++i]);
+        else if(arg=="--csv" && i+1<argc)
+            csv=argv[++i];
+        else{
+            std::cerr<<"usage: "<<argv[0]<<" [--filter substring] [--warmup N] [--samples N] [--csv path]"<<std::endl;
+            return 1;
+        }
+    }
+
+    Bench bench(warmup, samples, filter);
+    benchClear(bench);
+    benchTriangles(bench);
+    benchLines(bench);
+    benchTransform(bench);
+    benchSample(bench);
+    benchRender(bench);
+    benchInstances(bench);
+    benchContexts(bench);
+
+    if(!csv.empty() && !bench.writeCsv(csv)){
+        std::cerr<<"Failed to write "<<csv<<std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "AssetManager.hpp"
+#include "ThreadPool.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+std::mutex AssetManager::mutex;
+std::unordered_map<std::string, std::weak_ptr<Texture>> AssetManager::textures;
+std::unordered_map<std::string, TextureFuture> AssetManager::pending;
+
+ThreadPool& AssetManager::getPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+TextureFuture AssetManager::loadTextureAsync(const std::string& file_path, TextureType type, TextureFormat format)
+{
+    std::error_code error;
+    std::string canonical_path=std::filesystem::weakly_canonical(file_path, error).string();
+    if(error)
+        canonical_path=file_path;
+    std::string key=canonical_path+'|'+std::to_string(type)+'|'+std::to_string(static_cast<int>(format));
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // alive or already decoding
+    auto found=textures.find(key);
+    if(found!=textures.end()){
+        if(TextureHandle texture=found->second.lock()){
+            std::promise<TextureHandle> ready;
+            ready.set_value(std::move(texture));
+            return ready.get_future().share();
+        }
+        textures.erase(found);
+    }
+    auto loading=pending.find(key);
+    if(loading!=pending.end())
+        return loading->second;
+
+    TextureFuture future=getPool().submit([key, canonical_path, type, format]{
+        TextureHandle texture;
+        try{
+            texture=std::make_shared<Texture>(canonical_path, type, format);
+        }catch(const std::exception& e){
+            std::cerr<<e.what()<<std::endl;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(texture)
+            textures[key]=texture;
+        pending.erase(key);
+        return texture;
+    }).share();
+    pending[key]=future;
+    return future;
+}
+
+TextureHandle AssetManager::loadTexture(const std::string& file_path, TextureType type, TextureFormat format)
+{
+    return loadTextureAsync(file_path, type, format).get();
+}
+
+size_t AssetManager::getTextureCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count=0;
+    for(const auto& [key, texture]: textures)
+        count+=!texture.expired();
+    return count;
+}
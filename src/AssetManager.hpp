@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Texture.hpp"
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class ThreadPool;
+
+using TextureHandle=std::shared_ptr<Texture>;
+using TextureFuture=std::shared_future<TextureHandle>;
+
+// Process-wide texture cache keyed by canonical path, type and format.
+// Textures are decoded on a worker pool and shared between every model
+// that references them; a texture is freed with its last handle. A failed
+// load yields a null handle and is retried on the next request.
+class AssetManager{
+private:
+    static std::mutex                                             mutex;
+    static std::unordered_map<std::string, std::weak_ptr<Texture>> textures;
+    static std::unordered_map<std::string, TextureFuture>          pending;
+
+    static ThreadPool& getPool();
+
+public:
+    static TextureFuture loadTextureAsync(const std::string& file_path, TextureType type,
+        TextureFormat format=TextureFormat::RGBA8);
+    static TextureHandle loadTexture(const std::string& file_path, TextureType type,
+        TextureFormat format=TextureFormat::RGBA8);
+
+    // textures currently alive
+    static size_t getTextureCount();
+};
@@ -39,7 +39,7 @@ public:
     direct_t getPosition();
     direct_t getFront();
     matrix_t getView();
-    matrix_t getProjection();
+    matrix_t getProjection(float aspect=(float)SCR_WIDTH/SCR_HEIGHT);
 
     void processKeyboard(CameraMovement direction, float delta_time);
     void processMouseMovement(float x_ofs, float y_ofs, bool constrain_pitch=true);
@@ -61,7 +61,7 @@ inline matrix_t Camera::getView()
     return Geometry::lookAt(position, position+front, up);
 }
 
-inline matrix_t Camera::getProjection()
+inline matrix_t Camera::getProjection(float aspect)
 {
-    return Geometry::perspective(Geometry::radians(zoom), (float)SCR_WIDTH/SCR_HEIGHT, 0.1f, 100.0f);
+    return Geometry::perspective(zoom, aspect, 0.1f, 100.0f);
 }
@@ -0,0 +1,77 @@
+#include "Clipper.hpp"
+
+#include <algorithm>
+#include <utility>
+
+// signed distance to a clip plane, inside is >= 0
+static float distance(const vec4f_t& p, uint32_t plane)
+{
+    constexpr float g=Coverage::GUARD_BAND;
+    switch(plane){
+    case Clipper::DEPTH_NEAR:   return p[2];
+    case Clipper::DEPTH_FAR:    return p[3]-p[2];
+    case Clipper::GUARD_LEFT:   return p[0]+g*p[3];
+    case Clipper::GUARD_RIGHT:  return g*p[3]-p[0];
+    case Clipper::GUARD_TOP:    return p[1]+g*p[3];
+    case Clipper::GUARD_BOTTOM: return g*p[3]-p[1];
+    default:                    return 0.f;
+    }
+}
+
+static ClipVertex lerp(const ClipVertex& a, const ClipVertex& b, float t)
+{
+    return {
+        a.position+t*(b.position-a.position),
+        a.normal+t*(b.normal-a.normal),
+        a.texcoord+t*(b.texcoord-a.texcoord),
+        a.color+t*(b.color-a.color),
+    };
+}
+
+bool Clipper::isBoxOutside(const vec3f_t& min, const vec3f_t& max, const matrix_t& mvp, float width, float height)
+{
+    // planes are linear in clip space, so the corners bound the whole box
+    uint32_t shared=~0u;
+    for(int i=0; i<8 && shared; i++){
+        vec4f_t corner((i&1) ? max.x() : min.x(), (i&2) ? max.y() : min.y(), (i&4) ? max.z() : min.z(), 1.f);
+        shared&=outcode(mvp*corner, width, height);
+    }
+    return shared!=0;
+}
+
+int Clipper::clip(Polygon& polygon, uint32_t planes)
+{
+    // Sutherland-Hodgman, one plane at a time
+    Polygon buffer;
+    Polygon* in=&polygon;
+    Polygon* out=&buffer;
+    int count=3;
+
+    for(uint32_t plane=DEPTH_NEAR; plane<=GUARD_BOTTOM && count>0; plane<<=1){
+        if(!(planes&plane))
+            continue;
+
+        int n=0;
+        for(int i=0; i<count; i++){
+            const ClipVertex& a=(*in)[i];
+            const ClipVertex& b=(*in)[(i+1)%count];
+            float da=distance(a.position, plane);
+            float db=distance(b.position, plane);
+
+            // new corners are always interpolated from the inside end, so
+            // an edge shared by two triangles is cut at the same point
+            if(da>=0.f)
+                (*out)[n++]=a;
+            if(da>=0.f && db<0.f)
+                (*out)[n++]=lerp(a, b, da/(da-db));
+            else if(da<0.f && db>=0.f)
+                (*out)[n++]=lerp(b, a, db/(db-da));
+        }
+        count=n;
+        std::swap(in, out);
+    }
+
+    if(in!=&polygon)
+        std::copy(in->begin(), in->begin()+count, polygon.begin());
+    return count;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "global.hpp"
+#include "Coverage.hpp"
+
+// one polygon corner before the divide by w
+struct ClipVertex{
+    vec4f_t    position;
+    normal_t   normal;
+    texcoord_t texcoord;
+    color_t    color;
+};
+
+// Homogeneous clipping in the space the shader's projection maps to: screen
+// space before the divide by w, x and y in pixels and depth in [0, 1].
+// Triangles are only clipped against near, far and the fixed-point guard
+// band; the viewport planes reject whole triangles and shapes, and the
+// rasterizer scissors everything that still overlaps the edges.
+class Clipper{
+public:
+    static constexpr uint32_t LEFT=1<<0;
+    static constexpr uint32_t RIGHT=1<<1;
+    static constexpr uint32_t TOP=1<<2;
+    static constexpr uint32_t BOTTOM=1<<3;
+    static constexpr uint32_t DEPTH_NEAR=1<<4;
+    static constexpr uint32_t DEPTH_FAR=1<<5;
+    static constexpr uint32_t GUARD_LEFT=1<<6;
+    static constexpr uint32_t GUARD_RIGHT=1<<7;
+    static constexpr uint32_t GUARD_TOP=1<<8;
+    static constexpr uint32_t GUARD_BOTTOM=1<<9;
+    static constexpr uint32_t CLIP_PLANES=DEPTH_NEAR|DEPTH_FAR|GUARD_LEFT|GUARD_RIGHT|GUARD_TOP|GUARD_BOTTOM;
+
+    // every clip plane can add at most one corner
+    static constexpr int MAX_VERTICES=3+6;
+    using Polygon=std::array<ClipVertex, MAX_VERTICES>;
+
+    // planes the point is outside of
+    static uint32_t outcode(const vec4f_t& p, float width, float height);
+
+    // true when the transformed box is entirely outside one plane
+    static bool isBoxOutside(const vec3f_t& min, const vec3f_t& max, const matrix_t& mvp, float width, float height);
+
+    // clips the triangle in polygon[0..2] against the given planes and
+    // returns the corner count of the convex result, 0 when nothing is left
+    static int clip(Polygon& polygon, uint32_t planes);
+};
+
+inline uint32_t Clipper::outcode(const vec4f_t& p, float width, float height)
+{
+    constexpr float g=Coverage::GUARD_BAND;
+    const float x=p[0], y=p[1], z=p[2], w=p[3];
+
+    uint32_t code=0;
+    code|=x<0.f         ? LEFT : 0;
+    code|=x>width*w     ? RIGHT : 0;
+    code|=y<0.f         ? TOP : 0;
+    code|=y>height*w    ? BOTTOM : 0;
+    code|=z<0.f         ? DEPTH_NEAR : 0;
+    code|=z>w           ? DEPTH_FAR : 0;
+    code|=x<-g*w        ? GUARD_LEFT : 0;
+    code|=x>g*w         ? GUARD_RIGHT : 0;
+    code|=y<-g*w        ? GUARD_TOP : 0;
+    code|=y>g*w         ? GUARD_BOTTOM : 0;
+    return code;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include "global.hpp"
+
+// Packed colors are RGBA8 with red in the lowest byte, which is GL_RGBA /
+// GL_UNSIGNED_BYTE on little-endian machines. Shading happens in linear
+// space, packed targets hold sRGB encoded values.
+
+inline float srgbToLinear(uint8_t value)
+{
+    static const auto table=[]{
+        std::array<float, 256> table;
+        for(int i=0; i<256; i++){
+            float c=i/255.f;
+            table[i]=c<=0.04045f ? c/12.92f : std::pow((c+0.055f)/1.055f, 2.4f);
+        }
+        return table;
+    }();
+    return table[value];
+}
+
+inline uint8_t linearToSrgb(float value)
+{
+    // 12-bit linear input keeps every sRGB code reachable
+    static const auto table=[]{
+        std::array<uint8_t, 4096> table;
+        for(int i=0; i<4096; i++){
+            float c=i/4095.f;
+            float s=c<=0.0031308f ? c*12.92f : 1.055f*std::pow(c, 1.f/2.4f)-0.055f;
+            table[i]=static_cast<uint8_t>(s*255.f+0.5f);
+        }
+        return table;
+    }();
+    // written so that NaN fails the test and encodes as 0, clamping would
+    // pass it on to the cast
+    value=value>0.f ? std::min(value, 1.f) : 0.f;
+    return table[static_cast<int>(value*4095.f+0.5f)];
+}
+
+inline uint32_t packSrgb(const color_t& color, float alpha=1.f)
+{
+    alpha=alpha>0.f ? std::min(alpha, 1.f) : 0.f;
+    return linearToSrgb(color.x())|linearToSrgb(color.y())<<8|linearToSrgb(color.z())<<16
+        |static_cast<uint32_t>(alpha*255.f+0.5f)<<24;
+}
+
+inline color_t unpackSrgb(uint32_t packed)
+{
+    return color_t(srgbToLinear(packed&0xff), srgbToLinear((packed>>8)&0xff), srgbToLinear((packed>>16)&0xff));
+}
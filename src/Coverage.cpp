@@ -0,0 +1,153 @@
+#include "Coverage.hpp"
+
+#include <bit>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+const SamplePattern& Coverage::samplePattern(int samples)
+{
+    static const SamplePattern patterns[]={
+        {1, {0}, {0}},
+        {2, {4, -4}, {4, -4}},
+        {4, {-2, 6, -6, 2}, {-6, -2, 2, 6}},
+        {8, {1, -1, 5, -3, -5, -7, 3, 7}, {-3, 3, 1, -5, 5, -1, 7, -7}},
+    };
+    switch(samples){
+    case 2:  return patterns[1];
+    case 4:  return patterns[2];
+    case 8:  return patterns[3];
+    default: return patterns[0];
+    }
+}
+
+bool Coverage::setup(const triangle_t& triangle, int min_x, int min_y, int max_x, int max_y)
+{
+    const auto& v=triangle.vertices;
+
+    // snap vertices to the subpixel grid
+    if(!inGuardBand(triangle))
+        return false;
+
+    int32_t x[3], y[3];
+    for(int i=0; i<3; i++){
+        x[i]=static_cast<int32_t>(std::lround(v[i].x()*SUBPIXEL_ONE));
+        y[i]=static_cast<int32_t>(std::lround(v[i].y()*SUBPIXEL_ONE));
+    }
+
+    // clamp bounding box to the given screen rectangle
+    this->min_x=std::max(min_x, static_cast<int>(std::floor(std::min({v[0].x(), v[1].x(), v[2].x()}))));
+    this->max_x=std::min(max_x, static_cast<int>(std::ceil(std::max({v[0].x(), v[1].x(), v[2].x()}))));
+    this->min_y=std::max(min_y, static_cast<int>(std::floor(std::min({v[0].y(), v[1].y(), v[2].y()}))));
+    this->max_y=std::min(max_y, static_cast<int>(std::ceil(std::max({v[0].y(), v[1].y(), v[2].y()}))));
+    if(this->min_x>this->max_x || this->min_y>this->max_y)
+        return false;
+
+    // edge k is opposite to vertex k, so E_k(v_k) is twice the signed area
+    for(int k=0; k<3; k++){
+        int i=(k+1)%3, j=(k+2)%3;
+        a[k]=y[i]-y[j];
+        b[k]=x[j]-x[i];
+        c[k]=-(int64_t(a[k])*x[i]+int64_t(b[k])*y[i]);
+    }
+    area=c[0]+int64_t(a[0])*x[0]+int64_t(b[0])*y[0];
+    if(area==0)
+        return false;
+
+    // accept both windings by making the inside positive
+    if(area<0){
+        for(int k=0; k<3; k++){
+            a[k]=-a[k];
+            b[k]=-b[k];
+            c[k]=-c[k];
+        }
+        area=-area;
+    }
+    inv_area=1.f/static_cast<float>(area);
+
+    // top-left fill rule: pixels exactly on other edges are left out
+    for(int k=0; k<3; k++)
+        if(!(a[k]>0 || (a[k]==0 && b[k]>0)))
+            c[k]-=1;
+
+    return true;
+}
+
+uint64_t Coverage::blockMask(const int64_t* e, uint32_t edges) const
+{
+    uint64_t mask=~0ull;
+
+    // the edge crosses the block, so its values here fit in 32 bits
+    for(int k=0; k<3; k++){
+        if(!(edges&(1u<<k)))
+            continue;
+
+        int32_t dx=a[k]*SUBPIXEL_ONE;
+        int32_t dy=b[k]*SUBPIXEL_ONE;
+        int32_t e0=static_cast<int32_t>(e[k]);
+        uint64_t outside=0;
+
+#if defined(__AVX2__)
+        __m256i row=_mm256_add_epi32(_mm256_set1_epi32(e0),
+            _mm256_mullo_epi32(_mm256_set1_epi32(dx), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+        __m256i step=_mm256_set1_epi32(dy);
+        for(int j=0; j<BLOCK_SIZE; j++){
+            outside|=uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(row)))<<(8*j);
+            row=_mm256_add_epi32(row, step);
+        }
+#elif defined(__SSE2__)
+        __m128i lo=_mm_add_epi32(_mm_set1_epi32(e0), _mm_setr_epi32(0, dx, 2*dx, 3*dx));
+        __m128i hi=_mm_add_epi32(lo, _mm_set1_epi32(4*dx));
+        __m128i step=_mm_set1_epi32(dy);
+        for(int j=0; j<BLOCK_SIZE; j++){
+            uint32_t bits=_mm_movemask_ps(_mm_castsi128_ps(lo))|(_mm_movemask_ps(_mm_castsi128_ps(hi))<<4);
+            outside|=uint64_t(bits)<<(8*j);
+            lo=_mm_add_epi32(lo, step);
+            hi=_mm_add_epi32(hi, step);
+        }
+#else
+        for(int j=0; j<BLOCK_SIZE; j++)
+            for(int i=0; i<BLOCK_SIZE; i++)
+                if(e0+i*dx+j*dy<0)
+                    outside|=1ull<<(8*j+i);
+#endif
+
+        mask&=~outside;
+    }
+
+    return mask;
+}
+
+void Coverage::sampleMasks(const int64_t* e, uint32_t edges, uint64_t pixels, const int32_t (*step)[MAX_SAMPLES],
+    uint32_t all, uint8_t* coverage) const
+{
+    // as in blockMask, edge values inside a crossed block fit in 32 bits
+#if defined(__AVX2__)
+    __m256i steps[3];
+    for(int k=0; k<3; k++)
+        steps[k]=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(step[k]));
+#endif
+
+    while(pixels){
+        int bit=std::countr_zero(pixels);
+        pixels&=pixels-1;
+
+        int32_t px=(bit&(BLOCK_SIZE-1))*SUBPIXEL_ONE, py=bit/BLOCK_SIZE*SUBPIXEL_ONE;
+        uint32_t outside=0;
+        for(int k=0; k<3; k++){
+            if(!(edges&(1u<<k)))
+                continue;
+            int32_t center=static_cast<int32_t>(e[k])+a[k]*px+b[k]*py;
+#if defined(__AVX2__)
+            __m256i values=_mm256_add_epi32(_mm256_set1_epi32(center), steps[k]);
+            outside|=_mm256_movemask_ps(_mm256_castsi256_ps(values));
+#else
+            for(int s=0; s<MAX_SAMPLES; s++)
+                if(center+step[k][s]<0)
+                    outside|=1u<<s;
+#endif
+        }
+        coverage[bit]=static_cast<uint8_t>(all&~outside);
+    }
+}
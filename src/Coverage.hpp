@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+
+#include "global.hpp"
+
+// Fixed-point edge equations of one screen-space triangle. Coverage is
+// evaluated for whole 8x8 pixel blocks: blocks outside any edge are rejected,
+// blocks inside all edges are accepted, and only blocks crossed by an edge
+// are evaluated per pixel with SIMD.
+
+// sample positions inside a pixel as offsets from its center in subpixel
+// units, the standard 2x/4x/8x multisample patterns
+struct SamplePattern{
+    int    count;
+    int8_t x[8], y[8];
+};
+
+class Coverage{
+public:
+    static constexpr int   SUBPIXEL_BITS=4;
+    static constexpr int   SUBPIXEL_ONE=1<<SUBPIXEL_BITS;
+    static constexpr int   BLOCK_SIZE=8;
+    static constexpr float GUARD_BAND=8192.f;
+    static constexpr int   MAX_SAMPLES=8;
+
+private:
+    // E(x, y)=a*x+b*y+c with x and y in subpixel units, sampled at pixel centers
+    int32_t a[3], b[3];
+    int64_t c[3];
+    int64_t area;
+    float   inv_area;
+    int     min_x, min_y, max_x, max_y;
+
+    uint64_t blockMask(const int64_t* e, uint32_t edges) const;
+    // sample masks of single pixels of the block, step holds the edge
+    // value offset of every sample from the pixel center
+    void sampleMasks(const int64_t* e, uint32_t edges, uint64_t pixels, const int32_t (*step)[MAX_SAMPLES],
+        uint32_t all, uint8_t* coverage) const;
+
+    // visits every block that is not outside an edge, pad widens the
+    // reject and accept tests by that many subpixels around each pixel center
+    template<typename F>
+    void traverseBlocks(int pad, F&& visit) const;
+
+public:
+    static bool inGuardBand(const triangle_t& triangle);
+    // pattern for 1, 2, 4 or 8 samples, other counts give the single center sample
+    static const SamplePattern& samplePattern(int samples);
+
+    bool setup(const triangle_t& triangle, int min_x, int min_y, int max_x, int max_y);
+
+    template<typename F>
+    void traverse(F&& emit) const;
+    // emits the pixels with any sample covered, the pixels with all samples
+    // covered and the sample mask of every other emitted pixel
+    template<typename F>
+    void traverse(const SamplePattern& pattern, F&& emit) const;
+
+    auto barycentric(int x, int y) const -> std::tuple<float, float, float>;
+
+    int getMinX() const {return min_x;}
+    int getMinY() const {return min_y;}
+    int getMaxX() const {return max_x;}
+    int getMaxY() const {return max_y;}
+};
+
+inline bool Coverage::inGuardBand(const triangle_t& triangle)
+{
+    for(const auto& v: triangle.vertices)
+        if(!(std::abs(v.x())<=GUARD_BAND && std::abs(v.y())<=GUARD_BAND))
+            return false;
+    return true;
+}
+
+inline std::tuple<float, float, float> Coverage::barycentric(int x, int y) const
+{
+    int64_t px=x*SUBPIXEL_ONE+SUBPIXEL_ONE/2;
+    int64_t py=y*SUBPIXEL_ONE+SUBPIXEL_ONE/2;
+    float alpha=(a[0]*px+b[0]*py+c[0])*inv_area;
+    float beta=(a[1]*px+b[1]*py+c[1])*inv_area;
+
+    return {alpha, beta, 1.f-alpha-beta};
+}
+
+template<typename F>
+void Coverage::traverseBlocks(int pad, F&& visit) const
+{
+    int bx0=min_x&~(BLOCK_SIZE-1);
+    int by0=min_y&~(BLOCK_SIZE-1);
+    constexpr int last=(BLOCK_SIZE-1)*SUBPIXEL_ONE;
+    constexpr int step=BLOCK_SIZE*SUBPIXEL_ONE;
+
+    // edge values at the first pixel center of the first block, stepped per block
+    int64_t row[3], lo[3], hi[3];
+    for(int k=0; k<3; k++){
+        row[k]=a[k]*(int64_t(bx0)*SUBPIXEL_ONE+SUBPIXEL_ONE/2)+b[k]*(int64_t(by0)*SUBPIXEL_ONE+SUBPIXEL_ONE/2)+c[k];
+        lo[k]=std::min(a[k], 0)*int64_t(last+pad)-std::max(a[k], 0)*int64_t(pad)
+             +std::min(b[k], 0)*int64_t(last+pad)-std::max(b[k], 0)*int64_t(pad);
+        hi[k]=std::max(a[k], 0)*int64_t(last+pad)-std::min(a[k], 0)*int64_t(pad)
+             +std::max(b[k], 0)*int64_t(last+pad)-std::min(b[k], 0)*int64_t(pad);
+    }
+
+    for(int by=by0; by<=max_y; by+=BLOCK_SIZE){
+        int64_t e[3]={row[0], row[1], row[2]};
+
+        // rows of the block inside [min_y, max_y]
+        int y0=std::max(min_y-by, 0), y1=std::min(max_y-by, BLOCK_SIZE-1);
+        uint64_t rows=(~0ull>>(56-8*y1))&(~0ull<<(8*y0));
+
+        for(int bx=bx0; bx<=max_x; bx+=BLOCK_SIZE){
+            // trivial reject when the block is outside one edge, and collect
+            // the edges that actually cross the block
+            uint32_t partial=0;
+            bool outside=false;
+            for(int k=0; k<3; k++){
+                if(e[k]+hi[k]<0)
+                    outside=true;
+                else if(e[k]+lo[k]<0)
+                    partial|=1u<<k;
+            }
+
+            if(!outside){
+                int x0=std::max(min_x-bx, 0), x1=std::min(max_x-bx, BLOCK_SIZE-1);
+                uint64_t columns=((0xffu>>(7-x1))&(0xffu<<x0))*0x0101010101010101ull;
+                visit(bx, by, e, partial, rows&columns);
+            }
+
+            for(int k=0; k<3; k++)
+                e[k]+=int64_t(a[k])*step;
+        }
+
+        for(int k=0; k<3; k++)
+            row[k]+=int64_t(b[k])*step;
+    }
+}
+
+template<typename F>
+void Coverage::traverse(F&& emit) const
+{
+    traverseBlocks(0, [&](int bx, int by, const int64_t* e, uint32_t partial, uint64_t mask){
+        if(partial)
+            mask&=blockMask(e, partial);
+        if(mask)
+            emit(bx, by, mask);
+    });
+}
+
+template<typename F>
+void Coverage::traverse(const SamplePattern& pattern, F&& emit) const
+{
+    // the edge functions are linear, so a sample's value is the pixel
+    // center value plus a constant step per edge
+    int32_t step[3][MAX_SAMPLES]={};
+    int64_t lo[3], hi[3];
+    for(int k=0; k<3; k++){
+        lo[k]=hi[k]=a[k]*pattern.x[0]+b[k]*pattern.y[0];
+        for(int s=0; s<pattern.count; s++){
+            step[k][s]=a[k]*pattern.x[s]+b[k]*pattern.y[s];
+            lo[k]=std::min<int64_t>(lo[k], step[k][s]);
+            hi[k]=std::max<int64_t>(hi[k], step[k][s]);
+        }
+    }
+    const uint32_t all=(1u<<pattern.count)-1;
+
+    // samples lie within half a pixel of the center, edges that keep the
+    // whole padded block inside cover every sample
+    uint8_t coverage[BLOCK_SIZE*BLOCK_SIZE];
+    traverseBlocks(SUBPIXEL_ONE/2, [&](int bx, int by, const int64_t* e, uint32_t partial, uint64_t mask){
+        if(!partial){
+            emit(bx, by, mask, mask, coverage);
+            return;
+        }
+
+        // pixels with every sample inside and pixels with any sample inside,
+        // only those in between are tested per sample
+        int64_t inner_e[3], outer_e[3];
+        for(int k=0; k<3; k++){
+            inner_e[k]=e[k]+lo[k];
+            outer_e[k]=e[k]+hi[k];
+        }
+        uint64_t full=mask&blockMask(inner_e, partial);
+        uint64_t pixels=mask&blockMask(outer_e, partial);
+
+        uint64_t edge=pixels&~full;
+        if(edge){
+            sampleMasks(e, partial, edge, step, all, coverage);
+            while(edge){
+                int bit=std::countr_zero(edge);
+                edge&=edge-1;
+                if(!coverage[bit])
+                    pixels&=~(1ull<<bit);
+            }
+        }
+        if(pixels)
+            emit(bx, by, pixels, full, coverage);
+    });
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "global.hpp"
+
+// Per-pixel surfaces of the deferred geometry pass, one array per
+// attribute. Depth stays in the rasterizer's z_buffer; the triangle index
+// points into the frame's bins and gives the shader inputs and the
+// texcoord derivatives back.
+struct GBuffer{
+    static constexpr uint32_t EMPTY=~0u;
+
+    std::vector<uint32_t> normals;      // octahedral, 16 bits per axis
+    std::vector<float>    texcoord_u;
+    std::vector<float>    texcoord_v;
+    std::vector<uint32_t> albedo;       // packed sRGB vertex color
+    std::vector<uint32_t> triangles;    // binned triangle, EMPTY where nothing was drawn
+
+    void resize(size_t pixels)
+    {
+        normals.resize(pixels);
+        texcoord_u.resize(pixels);
+        texcoord_v.resize(pixels);
+        albedo.resize(pixels);
+        triangles.assign(pixels, EMPTY);
+    }
+
+    // the other surfaces are only read where a triangle was written
+    void clear() {std::fill(triangles.begin(), triangles.end(), EMPTY);}
+};
+
+inline uint32_t packNormal(const normal_t& normal)
+{
+    // project onto the octahedron and fold the lower half over
+    float l1=std::abs(normal.x())+std::abs(normal.y())+std::abs(normal.z());
+    if(l1==0.f)
+        return 0x80008000u;
+    float x=normal.x()/l1, y=normal.y()/l1;
+    if(normal.z()<0.f){
+        float fx=(1.f-std::abs(y))*(x>=0.f ? 1.f : -1.f);
+        float fy=(1.f-std::abs(x))*(y>=0.f ? 1.f : -1.f);
+        x=fx;
+        y=fy;
+    }
+    auto quantize=[](float v){ return static_cast<uint32_t>(std::lround((std::clamp(v, -1.f, 1.f)*0.5f+0.5f)*65535.f)); };
+    return quantize(x)|quantize(y)<<16;
+}
+
+inline normal_t unpackNormal(uint32_t packed)
+{
+    float x=(packed&0xffff)/65535.f*2.f-1.f;
+    float y=(packed>>16)/65535.f*2.f-1.f;
+    float z=1.f-std::abs(x)-std::abs(y);
+    if(z<0.f){
+        float fx=(1.f-std::abs(y))*(x>=0.f ? 1.f : -1.f);
+        float fy=(1.f-std::abs(x))*(y>=0.f ? 1.f : -1.f);
+        x=fx;
+        y=fy;
+    }
+    return normal_t(x, y, z).normalized();
+}
@@ -80,3 +80,15 @@ matrix_t Geometry::ortho(float left, float right, float bottom, float top, float
     
     return res;
 }
+
+matrix_t Geometry::viewport(float x, float y, float w, float h, float zNear, float zFar)
+{
+    // y points down so that row 0 of the frame buffer is the top of the image
+    matrix_t res;
+    res<<w/2.f, 0.f, 0.f, x+w/2.f,
+        0.f, -h/2.f, 0.f, y+h/2.f,
+        0.f, 0.f, (zFar-zNear)/2.f, (zFar+zNear)/2.f,
+        0.f, 0.f, 0.f, 1.f;
+
+    return res;
+}
@@ -0,0 +1,71 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& file_path)
+: data(nullptr), size(0), file_handle(INVALID_HANDLE_VALUE), mapping_handle(nullptr)
+{
+    file_handle=CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file_handle==INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart==0)
+        return;
+
+    mapping_handle=CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mapping_handle==nullptr)
+        return;
+
+    data=static_cast<const unsigned char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if(data!=nullptr)
+        size=static_cast<size_t>(file_size.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+    if(data!=nullptr)
+        UnmapViewOfFile(data);
+    if(mapping_handle!=nullptr)
+        CloseHandle(mapping_handle);
+    if(file_handle!=INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle);
+}
+#else
+MappedFile::MappedFile(const std::string& file_path)
+: data(nullptr), size(0), fd(-1)
+{
+    fd=open(file_path.c_str(), O_RDONLY);
+    if(fd<0)
+        return;
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat)!=0 || file_stat.st_size==0)
+        return;
+
+    void* mapping=mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping==MAP_FAILED)
+        return;
+
+    data=static_cast<const unsigned char*>(mapping);
+    size=static_cast<size_t>(file_stat.st_size);
+}
+
+MappedFile::~MappedFile()
+{
+    if(data!=nullptr)
+        munmap(const_cast<unsigned char*>(data), size);
+    if(fd>=0)
+        close(fd);
+}
+#endif
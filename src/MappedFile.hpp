@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. Pages are loaded on first
+// access, so opening is cheap regardless of the file size.
+class MappedFile{
+private:
+    const unsigned char* data;
+    size_t               size;
+#ifdef _WIN32
+    void*                file_handle;
+    void*                mapping_handle;
+#else
+    int                  fd;
+#endif
+
+public:
+    MappedFile(const std::string& file_path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&)=delete;
+    MappedFile& operator=(const MappedFile&)=delete;
+
+    bool isOpen() const                 {return data!=nullptr;}
+    const unsigned char* getData() const {return data;}
+    size_t getSize() const              {return size;}
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+#include "global.hpp"
+#include "AssetManager.hpp"
+
+// One obj material with its textures resolved. Models build a table of
+// these once, so drawing indexes a record instead of looking names up.
+struct Material{
+    std::string   name;
+    vec3f_t       ambient=vec3f_t::Zero();
+    vec3f_t       diffuse=vec3f_t::Zero();
+    vec3f_t       specular=vec3f_t::Zero();
+    TextureHandle diffuse_texture;
+    TextureHandle specular_texture;
+    TextureHandle bump_texture;
+};
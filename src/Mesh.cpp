@@ -0,0 +1,413 @@
+#include "Mesh.hpp"
+#include "Simplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+// obj corner, one index per attribute
+struct CornerKey{
+    int vertex_index;
+    int normal_index;
+    int texcoord_index;
+
+    bool operator==(const CornerKey& other) const
+    {
+        return vertex_index==other.vertex_index && normal_index==other.normal_index && texcoord_index==other.texcoord_index;
+    }
+};
+
+struct CornerHash{
+    size_t operator()(const CornerKey& key) const
+    {
+        uint64_t h=static_cast<uint32_t>(key.vertex_index);
+        h=h*0x9e3779b97f4a7c15ull^static_cast<uint32_t>(key.normal_index);
+        h=h*0x9e3779b97f4a7c15ull^static_cast<uint32_t>(key.texcoord_index);
+        return static_cast<size_t>(h^(h>>29));
+    }
+};
+
+void Mesh::sortByMaterial(DrawRange& range)
+{
+    // stable, so faces keep their obj order within a material
+    uint32_t first=range.index_offset/3;
+    uint32_t count=range.index_count/3;
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), first);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+        return material_data[a]<material_data[b];
+    });
+
+    std::vector<uint32_t> sorted_indices(range.index_count);
+    std::vector<int> sorted_materials(count);
+    for(uint32_t i=0; i<count; i++){
+        for(int v=0; v<3; v++)
+            sorted_indices[3*i+v]=index_data[3*order[i]+v];
+        sorted_materials[i]=material_data[order[i]];
+    }
+    std::copy(sorted_indices.begin(), sorted_indices.end(), index_data.begin()+range.index_offset);
+    std::copy(sorted_materials.begin(), sorted_materials.end(), material_data.begin()+first);
+
+    range.batch_offset=static_cast<uint32_t>(batches.size());
+    appendBatches(first, count);
+    range.batch_count=static_cast<uint32_t>(batches.size())-range.batch_offset;
+}
+
+void Mesh::appendBatches(uint32_t first, uint32_t count)
+{
+    for(uint32_t i=first; i<first+count; i++){
+        if(i==first || material_data[i]!=material_data[i-1])
+            batches.push_back({3*i, 0, material_data[i]});
+        batches.back().index_count+=3;
+    }
+}
+
+std::vector<int> Mesh::buildLods(DrawRange& range)
+{
+    range.lod_offset=static_cast<uint32_t>(lods.size());
+    lods.push_back({range.index_offset, range.index_count, range.batch_offset, range.batch_count, range.vertex_count, 0.f});
+
+    Simplifier simplifier(position_data, range.vertex_offset, range.vertex_count,
+        std::span<const uint32_t>(index_data).subspan(range.index_offset, range.index_count),
+        std::span<const int>(material_data).subspan(range.index_offset/3, range.index_count/3));
+
+    // every level aims at half the triangles of the one before, locked
+    // seams end the chain once a level no longer gets much smaller;
+    // a vertex is used up to the level before the one it collapsed in
+    std::vector<int> vertex_levels(range.vertex_count, MAX_LODS);
+    std::vector<std::vector<uint32_t>> level_indices;
+    std::vector<std::vector<int>> level_materials;
+    std::vector<float> level_errors;
+    for(int level=1; level<MAX_LODS; level++){
+        size_t before=simplifier.getTriangleCount();
+        if(before<2*MIN_LOD_TRIANGLES || !simplifier.simplify(before/2))
+            break;
+        for(uint32_t v=0; v<range.vertex_count; v++)
+            if(vertex_levels[v]==MAX_LODS && simplifier.isRemoved(range.vertex_offset+v))
+                vertex_levels[v]=level;
+        if(simplifier.getTriangleCount()*4>before*3)
+            break;
+        level_indices.emplace_back();
+        level_materials.emplace_back();
+        simplifier.getTriangles(level_indices.back(), level_materials.back());
+        level_errors.push_back(simplifier.getError());
+    }
+
+    // levels keep the old vertex numbers until orderVertices
+    for(size_t l=0; l<level_indices.size(); l++){
+        DrawLod lod;
+        lod.index_offset=static_cast<uint32_t>(index_data.size());
+        lod.index_count=static_cast<uint32_t>(level_indices[l].size());
+        index_data.insert(index_data.end(), level_indices[l].begin(), level_indices[l].end());
+        material_data.insert(material_data.end(), level_materials[l].begin(), level_materials[l].end());
+
+        lod.batch_offset=static_cast<uint32_t>(batches.size());
+        appendBatches(lod.index_offset/3, lod.index_count/3);
+        lod.batch_count=static_cast<uint32_t>(batches.size())-lod.batch_offset;
+        lod.vertex_count=static_cast<uint32_t>(std::count_if(vertex_levels.begin(), vertex_levels.end(),
+            [&](int level){ return level>static_cast<int>(l+1); }));
+        lod.error=level_errors[l];
+        lods.push_back(lod);
+    }
+    range.lod_count=static_cast<uint32_t>(lods.size())-range.lod_offset;
+    return vertex_levels;
+}
+
+void Mesh::buildMeshlets(DrawBatch& batch)
+{
+    const uint32_t* batch_indices=&index_data[batch.index_offset];
+    uint32_t count=batch.index_count/3;
+
+    // triangles around every vertex of the batch
+    std::unordered_map<uint32_t, uint32_t> local;
+    std::vector<uint32_t> corners(batch.index_count);
+    for(uint32_t i=0; i<batch.index_count; i++)
+        corners[i]=local.try_emplace(batch_indices[i], static_cast<uint32_t>(local.size())).first->second;
+    std::vector<uint32_t> first(local.size()+1, 0);
+    for(uint32_t corner: corners)
+        first[corner+1]++;
+    std::partial_sum(first.begin(), first.end(), first.begin());
+    std::vector<uint32_t> fill(first.begin(), first.end()-1);
+    std::vector<uint32_t> adjacent(batch.index_count);
+    for(uint32_t i=0; i<batch.index_count; i++)
+        adjacent[fill[corners[i]]++]=i/3;
+
+    std::vector<vec3f_t> face_normals(count);
+    for(uint32_t t=0; t<count; t++){
+        vec3f_t a=Eigen::Map<const vec3f_t>(&position_data[3*size_t(batch_indices[3*t])]);
+        vec3f_t b=Eigen::Map<const vec3f_t>(&position_data[3*size_t(batch_indices[3*t+1])]);
+        vec3f_t c=Eigen::Map<const vec3f_t>(&position_data[3*size_t(batch_indices[3*t+2])]);
+        face_normals[t]=(b-a).cross(c-a).normalized();
+        if(!face_normals[t].allFinite())
+            face_normals[t]=vec3f_t::Zero();
+    }
+
+    // greedy growth from the first free triangle: take the neighbour that
+    // adds the fewest vertices, then the one facing most like the meshlet
+    std::vector<uint8_t> assigned(count, 0);
+    std::vector<uint32_t> stamps(local.size(), 0);
+    std::vector<uint32_t> order, candidates;
+    order.reserve(count);
+    batch.meshlet_offset=static_cast<uint32_t>(meshlets.size());
+    uint32_t seed=0;
+    while(order.size()<count){
+        while(assigned[seed])
+            seed++;
+        uint32_t stamp=static_cast<uint32_t>(meshlets.size())+1;
+        uint32_t begin=static_cast<uint32_t>(order.size());
+        uint32_t vertex_count=0;
+        vec3f_t normal=vec3f_t::Zero();
+        candidates.clear();
+
+        uint32_t t=seed;
+        while(true){
+            assigned[t]=1;
+            order.push_back(t);
+            normal+=face_normals[t];
+            for(int v=0; v<3; v++){
+                uint32_t corner=corners[3*t+v];
+                if(stamps[corner]==stamp)
+                    continue;
+                stamps[corner]=stamp;
+                vertex_count++;
+                candidates.insert(candidates.end(), &adjacent[first[corner]], &adjacent[first[corner+1]]);
+            }
+            if(order.size()-begin==MESHLET_TRIANGLES)
+                break;
+
+            int best_added=4;
+            float best_facing=0.f;
+            size_t kept=0;
+            for(uint32_t candidate: candidates){
+                if(assigned[candidate])
+                    continue;
+                candidates[kept++]=candidate;
+                int added=0;
+                for(int v=0; v<3; v++)
+                    added+=stamps[corners[3*candidate+v]]!=stamp;
+                float facing=face_normals[candidate].dot(normal);
+                if(added<best_added || (added==best_added && facing>best_facing)){
+                    best_added=added;
+                    best_facing=facing;
+                    t=candidate;
+                }
+            }
+            candidates.resize(kept);
+            if(best_added==4 || vertex_count+best_added>MESHLET_VERTICES)
+                break;
+        }
+
+        meshlets.push_back({batch.index_offset+3*begin, 3*(static_cast<uint32_t>(order.size())-begin),
+            0, 0, vec3f_t::Zero(), 0.f, vec3f_t::UnitZ(), 1.f});
+    }
+    batch.meshlet_count=static_cast<uint32_t>(meshlets.size())-batch.meshlet_offset;
+
+    std::vector<uint32_t> sorted_indices(batch.index_count);
+    for(uint32_t i=0; i<count; i++)
+        for(int v=0; v<3; v++)
+            sorted_indices[3*i+v]=batch_indices[3*order[i]+v];
+    std::copy(sorted_indices.begin(), sorted_indices.end(), index_data.begin()+batch.index_offset);
+}
+
+void Mesh::orderVertices(DrawRange& range, const std::vector<int>& vertex_levels)
+{
+    // vertices that survive longest go first, within a level in the order
+    // the full-detail meshlets first use them
+    std::vector<uint32_t> first_use(range.vertex_count, std::numeric_limits<uint32_t>::max());
+    for(uint32_t i=range.index_offset+range.index_count; i-->range.index_offset;)
+        first_use[index_data[i]-range.vertex_offset]=i;
+    std::vector<uint32_t> order(range.vertex_count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+        if(vertex_levels[a]!=vertex_levels[b])
+            return vertex_levels[a]>vertex_levels[b];
+        return first_use[a]<first_use[b];
+    });
+
+    std::vector<uint32_t> remap(range.vertex_count);
+    for(uint32_t i=0; i<range.vertex_count; i++)
+        remap[order[i]]=range.vertex_offset+i;
+    auto permute=[&](std::vector<float>& stream, int width){
+        std::vector<float> old(stream.begin()+size_t(range.vertex_offset)*width, stream.begin()+size_t(range.vertex_offset+range.vertex_count)*width);
+        for(uint32_t i=0; i<range.vertex_count; i++)
+            std::copy_n(&old[size_t(order[i])*width], width, &stream[size_t(range.vertex_offset+i)*width]);
+    };
+    permute(position_data, 3);
+    permute(normal_data, 3);
+    permute(texcoord_data, 2);
+    permute(color_data, 3);
+    for(uint32_t l=range.lod_offset; l<range.lod_offset+range.lod_count; l++)
+        for(uint32_t i=lods[l].index_offset; i<lods[l].index_offset+lods[l].index_count; i++)
+            index_data[i]=remap[index_data[i]-range.vertex_offset];
+}
+
+void Mesh::boundMeshlets()
+{
+    std::vector<uint32_t> vertices;
+    for(Meshlet& meshlet: meshlets){
+        const uint32_t* meshlet_indices=&index_data[meshlet.index_offset];
+        vertices.assign(meshlet_indices, meshlet_indices+meshlet.index_count);
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+        meshlet.vertex_offset=static_cast<uint32_t>(meshlet_vertex_data.size());
+        meshlet.vertex_count=static_cast<uint32_t>(vertices.size());
+        meshlet_vertex_data.insert(meshlet_vertex_data.end(), vertices.begin(), vertices.end());
+
+        vec3f_t lo=vec3f_t::Constant(std::numeric_limits<float>::max());
+        vec3f_t hi=vec3f_t::Constant(std::numeric_limits<float>::lowest());
+        for(uint32_t v: vertices){
+            vec3f_t p=Eigen::Map<const vec3f_t>(&position_data[3*size_t(v)]);
+            lo=lo.cwiseMin(p);
+            hi=hi.cwiseMax(p);
+        }
+        meshlet.center=(lo+hi)*0.5f;
+        meshlet.radius=0.f;
+        for(uint32_t v: vertices)
+            meshlet.radius=std::max(meshlet.radius, (Eigen::Map<const vec3f_t>(&position_data[3*size_t(v)])-meshlet.center).norm());
+
+        // degenerate faces are culled by the rasterizer either way
+        std::vector<vec3f_t> face_normals;
+        vec3f_t axis=vec3f_t::Zero();
+        for(uint32_t i=0; i<meshlet.index_count; i+=3){
+            vec3f_t a=Eigen::Map<const vec3f_t>(&position_data[3*size_t(meshlet_indices[i])]);
+            vec3f_t b=Eigen::Map<const vec3f_t>(&position_data[3*size_t(meshlet_indices[i+1])]);
+            vec3f_t c=Eigen::Map<const vec3f_t>(&position_data[3*size_t(meshlet_indices[i+2])]);
+            vec3f_t normal=(b-a).cross(c-a).normalized();
+            if(!normal.allFinite())
+                continue;
+            face_normals.push_back(normal);
+            axis+=normal;
+        }
+        meshlet.cone_axis=axis.normalized();
+        meshlet.cone_cutoff=1.f;
+        if(!meshlet.cone_axis.allFinite()){
+            meshlet.cone_axis=vec3f_t::UnitZ();
+            continue;
+        }
+        float spread=1.f;
+        for(const vec3f_t& normal: face_normals)
+            spread=std::min(spread, normal.dot(meshlet.cone_axis));
+        if(spread>0.f)
+            meshlet.cone_cutoff=std::sqrt(1.f-spread*spread);
+    }
+}
+
+Mesh::Mesh(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes)
+{
+    size_t corner_count=0;
+    for(const auto& shape: shapes)
+        corner_count+=shape.mesh.indices.size();
+    index_data.reserve(corner_count);
+    material_data.reserve(corner_count/3);
+
+    std::unordered_map<CornerKey, uint32_t, CornerHash> lookup;
+    std::vector<bool> missing_normal;
+
+    for(const auto& shape: shapes){
+        DrawRange range;
+        range.name=shape.name;
+        range.vertex_offset=static_cast<uint32_t>(position_data.size()/3);
+        range.index_offset=static_cast<uint32_t>(index_data.size());
+        range.bounds_min=vec3f_t::Constant(std::numeric_limits<float>::max());
+        range.bounds_max=vec3f_t::Constant(std::numeric_limits<float>::lowest());
+
+        // vertices are not shared across shapes
+        lookup.clear();
+        lookup.reserve(shape.mesh.indices.size());
+
+        size_t index_offset=0;
+        for(size_t f=0; f<shape.mesh.num_face_vertices.size(); f++){
+            size_t fv=static_cast<size_t>(shape.mesh.num_face_vertices[f]);
+            if(fv!=3){
+                index_offset+=fv;
+                continue;
+            }
+
+            for(size_t v=0; v<3; v++){
+                const auto& idx=shape.mesh.indices[index_offset+v];
+                CornerKey key{idx.vertex_index, idx.normal_index, idx.texcoord_index};
+                auto [it, inserted]=lookup.try_emplace(key, static_cast<uint32_t>(position_data.size()/3));
+                index_data.push_back(it->second);
+                if(!inserted)
+                    continue;
+
+                size_t p=3*size_t(idx.vertex_index);
+                position_data.insert(position_data.end(), {attrib.vertices[p], attrib.vertices[p+1], attrib.vertices[p+2]});
+                range.bounds_min=range.bounds_min.cwiseMin(vec3f_t(attrib.vertices[p], attrib.vertices[p+1], attrib.vertices[p+2]));
+                range.bounds_max=range.bounds_max.cwiseMax(vec3f_t(attrib.vertices[p], attrib.vertices[p+1], attrib.vertices[p+2]));
+
+                if(idx.normal_index>=0){
+                    size_t n=3*size_t(idx.normal_index);
+                    normal_t normal=normal_t(attrib.normals[n], attrib.normals[n+1], attrib.normals[n+2]).normalized();
+                    normal_data.insert(normal_data.end(), {normal.x(), normal.y(), normal.z()});
+                }else{
+                    normal_data.insert(normal_data.end(), {0.f, 0.f, 0.f});
+                }
+                missing_normal.push_back(idx.normal_index<0);
+
+                if(idx.texcoord_index>=0){
+                    size_t t=2*size_t(idx.texcoord_index);
+                    texcoord_data.insert(texcoord_data.end(), {attrib.texcoords[t], attrib.texcoords[t+1]});
+                }else{
+                    texcoord_data.insert(texcoord_data.end(), {0.f, 0.f});
+                }
+
+                if(p+2<attrib.colors.size())
+                    color_data.insert(color_data.end(), {attrib.colors[p], attrib.colors[p+1], attrib.colors[p+2]});
+                else
+                    color_data.insert(color_data.end(), {1.f, 1.f, 1.f});
+            }
+
+            int id=f<shape.mesh.material_ids.size() ? shape.mesh.material_ids[f] : -1;
+            material_data.push_back(id);
+            index_offset+=fv;
+        }
+
+        range.vertex_count=static_cast<uint32_t>(position_data.size()/3)-range.vertex_offset;
+        range.index_count=static_cast<uint32_t>(index_data.size())-range.index_offset;
+        sortByMaterial(range);
+        ranges.push_back(range);
+    }
+
+    // corners without an obj normal get the area weighted face normals
+    for(size_t i=0; i<index_data.size(); i+=3){
+        uint32_t a=index_data[i], b=index_data[i+1], c=index_data[i+2];
+        if(!missing_normal[a] && !missing_normal[b] && !missing_normal[c])
+            continue;
+
+        vec3f_t pa=Eigen::Map<const vec3f_t>(&position_data[3*a]);
+        vec3f_t pb=Eigen::Map<const vec3f_t>(&position_data[3*b]);
+        vec3f_t pc=Eigen::Map<const vec3f_t>(&position_data[3*c]);
+        vec3f_t face=(pb-pa).cross(pc-pa);
+        for(uint32_t k: {a, b, c})
+            if(missing_normal[k])
+                for(int j=0; j<3; j++)
+                    normal_data[3*k+j]+=face[j];
+    }
+    for(size_t k=0; k<missing_normal.size(); k++){
+        if(!missing_normal[k])
+            continue;
+        Eigen::Map<vec3f_t> normal(&normal_data[3*k]);
+        if(normal.squaredNorm()>0.f)
+            normal.normalize();
+    }
+
+    for(DrawRange& range: ranges){
+        std::vector<int> vertex_levels=buildLods(range);
+        for(uint32_t l=range.lod_offset; l<range.lod_offset+range.lod_count; l++)
+            for(uint32_t b=lods[l].batch_offset; b<lods[l].batch_offset+lods[l].batch_count; b++)
+                buildMeshlets(batches[b]);
+        orderVertices(range, vertex_levels);
+    }
+    boundMeshlets();
+
+    positions=position_data;
+    normals=normal_data;
+    texcoords=texcoord_data;
+    colors=color_data;
+    indices=index_data;
+    material_ids=material_data;
+    meshlet_vertices=meshlet_vertex_data;
+}
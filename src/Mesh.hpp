@@ -0,0 +1,129 @@
+#pragma once
+
+#include "global.hpp"
+#include "tiny_obj_loader.h"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// consecutive triangles of one shape that share a material
+struct DrawBatch{
+    uint32_t index_offset;
+    uint32_t index_count;
+    int      material_id;   // -1 for faces without a material
+    uint32_t meshlet_offset=0;
+    uint32_t meshlet_count=0;
+};
+
+// a cluster of consecutive triangles of one batch, culled as a whole
+// against the frustum by its bounding sphere and against the eye by the
+// cone that holds all of its face normals
+struct Meshlet{
+    uint32_t index_offset;
+    uint32_t index_count;
+    uint32_t vertex_offset; // into meshlet_vertices
+    uint32_t vertex_count;
+    vec3f_t  center;
+    float    radius;
+    vec3f_t  cone_axis;
+    float    cone_cutoff;   // sine of the cone's half angle, 1 if it can't be culled
+};
+
+// one level of detail of a draw range; level 0 is the range itself,
+// coarser levels reuse its vertices and need only the first vertex_count
+struct DrawLod{
+    uint32_t index_offset;
+    uint32_t index_count;
+    uint32_t batch_offset;
+    uint32_t batch_count;
+    uint32_t vertex_count;
+    float    error;         // deviation from level 0 in object units
+};
+
+// a contiguous run of triangles from one obj shape, split into batches
+struct DrawRange{
+    std::string name;
+    uint32_t    vertex_offset;
+    uint32_t    vertex_count;
+    uint32_t    index_offset;
+    uint32_t    index_count;
+    uint32_t    batch_offset;
+    uint32_t    batch_count;
+    uint32_t    lod_offset=0;
+    uint32_t    lod_count=0;
+    vec3f_t     bounds_min;
+    vec3f_t     bounds_max;
+};
+
+// Deduplicated vertex streams (SoA) with a 32-bit index buffer, built once
+// at load time. Every distinct (position, normal, texcoord) corner of a
+// shape becomes one vertex; shapes own disjoint vertex and index ranges.
+// Within a shape triangles are sorted by material, so every material is
+// one DrawBatch. Each shape also gets a chain of simplified levels of
+// detail, whose triangles follow the full-detail ones in the index buffer;
+// its vertices are ordered so that coarser levels use a shorter prefix.
+// Every batch of every level is split into meshlets, its triangles are
+// grouped by meshlet and the vertices of a level follow the order the
+// meshlets first use them, so neighbours stay close in memory.
+// The streams are views into either the built arrays or a mapped cache
+// file (see MeshCache), so a mesh can be moved but not copied.
+class Mesh{
+public:
+    static constexpr int      MAX_LODS=8;
+    // shapes with fewer triangles are not simplified any further
+    static constexpr uint32_t MIN_LOD_TRIANGLES=64;
+    static constexpr uint32_t MESHLET_VERTICES=64;
+    static constexpr uint32_t MESHLET_TRIANGLES=128;
+
+private:
+    std::vector<float>          position_data;
+    std::vector<float>          normal_data;
+    std::vector<float>          texcoord_data;
+    std::vector<float>          color_data;
+    std::vector<uint32_t>       index_data;
+    std::vector<int>            material_data;
+    std::vector<uint32_t>       meshlet_vertex_data;
+    std::shared_ptr<MappedFile> mapping;
+
+    void sortByMaterial(DrawRange& range);
+    // one batch per run of equal materials among count triangles from first
+    void appendBatches(uint32_t first, uint32_t count);
+    // returns for every vertex of the range the first level without it
+    std::vector<int> buildLods(DrawRange& range);
+    // regroups the triangles of a batch into meshlets, bounds come later
+    void buildMeshlets(DrawBatch& batch);
+    void orderVertices(DrawRange& range, const std::vector<int>& vertex_levels);
+    void boundMeshlets();
+
+public:
+    std::span<const float>    positions;    // xyz per vertex
+    std::span<const float>    normals;      // xyz per vertex, unit length
+    std::span<const float>    texcoords;    // uv per vertex
+    std::span<const float>    colors;       // rgb per vertex
+    std::span<const uint32_t> indices;      // 3 per triangle of every level, absolute
+    std::span<const int>      material_ids; // 1 per triangle
+    std::span<const uint32_t> meshlet_vertices; // distinct vertices per meshlet, absolute
+    std::vector<DrawRange>    ranges;
+    std::vector<DrawBatch>    batches;
+    std::vector<DrawLod>      lods;
+    std::vector<Meshlet>      meshlets;
+
+    Mesh()=default;
+    Mesh(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes);
+
+    Mesh(const Mesh&)=delete;
+    Mesh& operator=(const Mesh&)=delete;
+    Mesh(Mesh&&)=default;
+    Mesh& operator=(Mesh&&)=default;
+
+    size_t getVertexCount() const   {return positions.size()/3;}
+    size_t getTriangleCount() const {return indices.size()/3;}
+    bool   isMapped() const         {return mapping!=nullptr;}
+
+friend class MeshCache;
+};
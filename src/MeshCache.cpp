@@ -0,0 +1,529 @@
+#include "MeshCache.hpp"
+#include "MappedFile.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+namespace fs=std::filesystem;
+
+// fixed part at the start of the file, all offsets are from the file start
+struct CacheHeader{
+    char     magic[4];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t reserved;
+    uint64_t file_size;
+    uint64_t meta_offset;
+    uint64_t meta_size;
+    uint64_t vertex_count;
+    uint64_t index_count;
+    uint64_t positions_offset;
+    uint64_t normals_offset;
+    uint64_t texcoords_offset;
+    uint64_t colors_offset;
+    uint64_t indices_offset;
+    uint64_t material_ids_offset;
+    uint64_t meshlet_vertex_count;
+    uint64_t meshlet_vertices_offset;
+};
+
+static const char     CACHE_MAGIC[4]={'R', 'S', 'M', 'C'};
+static const uint32_t CACHE_ENDIAN=0x01020304;
+static const size_t   CACHE_ALIGN=16;
+
+// a source file the cache was built from
+struct Dependency{
+    std::string name;
+    uint64_t    size;
+    int64_t     mtime;
+    uint64_t    hash;
+};
+
+static uint64_t hashFile(const fs::path& path)
+{
+    // FNV-1a
+    std::ifstream file(path, std::ios::binary);
+    uint64_t hash=0xcbf29ce484222325ull;
+    char buffer[1<<16];
+    while(file){
+        file.read(buffer, sizeof(buffer));
+        for(std::streamsize i=0; i<file.gcount(); i++)
+            hash=(hash^static_cast<unsigned char>(buffer[i]))*0x100000001b3ull;
+    }
+    return hash;
+}
+
+static bool statFile(const fs::path& path, uint64_t& size, int64_t& mtime)
+{
+    std::error_code error;
+    size=fs::file_size(path, error);
+    if(error)
+        return false;
+    mtime=static_cast<int64_t>(fs::last_write_time(path, error).time_since_epoch().count());
+    return !error;
+}
+
+std::vector<std::string> MeshCache::findMaterialLibraries(const std::string& obj_path, bool header_only)
+{
+    std::vector<std::string> names;
+    std::ifstream file(obj_path);
+    std::string line;
+    while(std::getline(file, line)){
+        if(header_only && line.compare(0, 2, "f ")==0)
+            break;
+        if(line.compare(0, 7, "mtllib ")!=0)
+            continue;
+        std::istringstream stream(line.substr(7));
+        std::string name;
+        while(stream>>name)
+            names.push_back(name);
+    }
+    return names;
+}
+
+class CacheWriter{
+private:
+    std::string buffer;
+
+public:
+    template<typename T>
+    void write(const T& value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    void writeArray(const T* values, size_t count)
+    {
+        buffer.append(reinterpret_cast<const char*>(values), sizeof(T)*count);
+    }
+
+    void writeString(const std::string& value)
+    {
+        write<uint32_t>(static_cast<uint32_t>(value.size()));
+        buffer.append(value);
+    }
+
+    void align()
+    {
+        buffer.resize((buffer.size()+CACHE_ALIGN-1)/CACHE_ALIGN*CACHE_ALIGN, '\0');
+    }
+
+    size_t size() const             {return buffer.size();}
+    std::string& data()             {return buffer;}
+};
+
+// bounds checked reads from the mapped metadata
+class CacheReader{
+private:
+    const unsigned char* data;
+    size_t               size;
+    size_t               offset;
+    bool                 valid;
+
+public:
+    CacheReader(const unsigned char* data, size_t size)
+    : data(data), size(size), offset(0), valid(true)
+    { }
+
+    template<typename T>
+    T read()
+    {
+        T value{};
+        readArray(&value, 1);
+        return value;
+    }
+
+    template<typename T>
+    void readArray(T* values, size_t count)
+    {
+        if(!valid || sizeof(T)*count>size-offset){
+            valid=false;
+            return;
+        }
+        memcpy(values, data+offset, sizeof(T)*count);
+        offset+=sizeof(T)*count;
+    }
+
+    // entry count of a table whose entries take at least min_size bytes
+    // each, a count the remaining bytes cannot hold invalidates the reader
+    uint32_t readCount(size_t min_size)
+    {
+        uint32_t count=read<uint32_t>();
+        if(!valid || count>(size-offset)/min_size){
+            valid=false;
+            return 0;
+        }
+        return count;
+    }
+
+    std::string readString()
+    {
+        uint32_t length=read<uint32_t>();
+        if(!valid || length>size-offset){
+            valid=false;
+            return {};
+        }
+        std::string value(reinterpret_cast<const char*>(data+offset), length);
+        offset+=length;
+        return value;
+    }
+
+    bool isValid() const {return valid;}
+};
+
+static void writeMaterial(CacheWriter& writer, const tinyobj::material_t& material)
+{
+    writer.writeString(material.name);
+    writer.writeArray(material.ambient, 3);
+    writer.writeArray(material.diffuse, 3);
+    writer.writeArray(material.specular, 3);
+    writer.writeArray(material.transmittance, 3);
+    writer.writeArray(material.emission, 3);
+    writer.write(material.shininess);
+    writer.write(material.ior);
+    writer.write(material.dissolve);
+    writer.write(material.illum);
+    writer.writeString(material.ambient_texname);
+    writer.writeString(material.diffuse_texname);
+    writer.writeString(material.specular_texname);
+    writer.writeString(material.specular_highlight_texname);
+    writer.writeString(material.bump_texname);
+    writer.writeString(material.displacement_texname);
+    writer.writeString(material.alpha_texname);
+    writer.writeString(material.reflection_texname);
+}
+
+static tinyobj::material_t readMaterial(CacheReader& reader)
+{
+    tinyobj::material_t material;
+    material.name=reader.readString();
+    reader.readArray(material.ambient, 3);
+    reader.readArray(material.diffuse, 3);
+    reader.readArray(material.specular, 3);
+    reader.readArray(material.transmittance, 3);
+    reader.readArray(material.emission, 3);
+    material.shininess=reader.read<tinyobj::real_t>();
+    material.ior=reader.read<tinyobj::real_t>();
+    material.dissolve=reader.read<tinyobj::real_t>();
+    material.illum=reader.read<int>();
+    material.ambient_texname=reader.readString();
+    material.diffuse_texname=reader.readString();
+    material.specular_texname=reader.readString();
+    material.specular_highlight_texname=reader.readString();
+    material.bump_texname=reader.readString();
+    material.displacement_texname=reader.readString();
+    material.alpha_texname=reader.readString();
+    material.reflection_texname=reader.readString();
+    return material;
+}
+
+std::string MeshCache::getCachePath(const std::string& obj_path)
+{
+    return obj_path+".mesh";
+}
+
+bool MeshCache::load(const std::string& obj_path, Mesh& mesh, std::vector<tinyobj::material_t>& materials)
+{
+    auto file=std::make_shared<MappedFile>(getCachePath(obj_path));
+    if(!file->isOpen() || file->getSize()<sizeof(CacheHeader))
+        return false;
+
+    CacheHeader header;
+    memcpy(&header, file->getData(), sizeof(header));
+    if(memcmp(header.magic, CACHE_MAGIC, 4)!=0 || header.version!=VERSION || header.endian!=CACHE_ENDIAN)
+        return false;
+    if(header.file_size!=file->getSize() || header.meta_offset>header.file_size
+        || header.meta_size>header.file_size-header.meta_offset)
+        return false;
+
+    // every stream must lie inside the file and be aligned for its type;
+    // the bytes left are divided down so that no count can overflow
+    auto checkStream=[&](uint64_t offset, uint64_t count, uint64_t components, size_t element){
+        return offset%CACHE_ALIGN==0 && offset<=header.file_size && count<=(header.file_size-offset)/element/components;
+    };
+    if(!checkStream(header.positions_offset, header.vertex_count, 3, sizeof(float))
+        || !checkStream(header.normals_offset, header.vertex_count, 3, sizeof(float))
+        || !checkStream(header.texcoords_offset, header.vertex_count, 2, sizeof(float))
+        || !checkStream(header.colors_offset, header.vertex_count, 3, sizeof(float))
+        || !checkStream(header.indices_offset, header.index_count, 1, sizeof(uint32_t))
+        || !checkStream(header.material_ids_offset, header.index_count/3, 1, sizeof(int))
+        || !checkStream(header.meshlet_vertices_offset, header.meshlet_vertex_count, 1, sizeof(uint32_t)))
+        return false;
+
+    CacheReader reader(file->getData()+header.meta_offset, header.meta_size);
+
+    // every table count is checked against the metadata left before
+    // anything is allocated for it, by the smallest size of one entry
+    constexpr size_t STRING_MIN=sizeof(uint32_t);
+    constexpr size_t DEPENDENCY_MIN=STRING_MIN+3*sizeof(uint64_t);
+    constexpr size_t RANGE_MIN=STRING_MIN+8*sizeof(uint32_t)+6*sizeof(float);
+    constexpr size_t BATCH_MIN=5*sizeof(uint32_t);
+    constexpr size_t LOD_MIN=5*sizeof(uint32_t)+sizeof(float);
+    constexpr size_t MESHLET_MIN=4*sizeof(uint32_t)+8*sizeof(float);
+    constexpr size_t MATERIAL_MIN=9*STRING_MIN+18*sizeof(tinyobj::real_t)+sizeof(int);
+
+    // sources first, a stale cache is rejected before reading anything else
+    fs::path obj_dir=fs::path(obj_path).parent_path();
+    uint32_t dependency_count=reader.readCount(DEPENDENCY_MIN);
+    for(uint32_t i=0; i<dependency_count && reader.isValid(); i++){
+        Dependency dependency;
+        dependency.name=reader.readString();
+        dependency.size=reader.read<uint64_t>();
+        dependency.mtime=reader.read<int64_t>();
+        dependency.hash=reader.read<uint64_t>();
+
+        fs::path path=obj_dir/dependency.name;
+        uint64_t size;
+        int64_t mtime;
+        if(!statFile(path, size, mtime) || size!=dependency.size)
+            return false;
+        if(mtime!=dependency.mtime && hashFile(path)!=dependency.hash)
+            return false;
+    }
+
+    std::vector<DrawRange> ranges(reader.readCount(RANGE_MIN));
+    for(auto& range: ranges){
+        range.name=reader.readString();
+        range.vertex_offset=reader.read<uint32_t>();
+        range.vertex_count=reader.read<uint32_t>();
+        range.index_offset=reader.read<uint32_t>();
+        range.index_count=reader.read<uint32_t>();
+        range.batch_offset=reader.read<uint32_t>();
+        range.batch_count=reader.read<uint32_t>();
+        range.lod_offset=reader.read<uint32_t>();
+        range.lod_count=reader.read<uint32_t>();
+        reader.readArray(range.bounds_min.data(), 3);
+        reader.readArray(range.bounds_max.data(), 3);
+        if(!reader.isValid() || uint64_t(range.index_offset)+range.index_count>header.index_count
+            || uint64_t(range.vertex_offset)+range.vertex_count>header.vertex_count)
+            return false;
+    }
+
+    std::vector<DrawBatch> batches(reader.readCount(BATCH_MIN));
+    for(auto& batch: batches){
+        batch.index_offset=reader.read<uint32_t>();
+        batch.index_count=reader.read<uint32_t>();
+        batch.material_id=reader.read<int32_t>();
+        batch.meshlet_offset=reader.read<uint32_t>();
+        batch.meshlet_count=reader.read<uint32_t>();
+    }
+
+    std::vector<DrawLod> lods(reader.readCount(LOD_MIN));
+    for(auto& lod: lods){
+        lod.index_offset=reader.read<uint32_t>();
+        lod.index_count=reader.read<uint32_t>();
+        lod.batch_offset=reader.read<uint32_t>();
+        lod.batch_count=reader.read<uint32_t>();
+        lod.vertex_count=reader.read<uint32_t>();
+        lod.error=reader.read<float>();
+    }
+
+    std::vector<Meshlet> meshlets(reader.readCount(MESHLET_MIN));
+    for(auto& meshlet: meshlets){
+        meshlet.index_offset=reader.read<uint32_t>();
+        meshlet.index_count=reader.read<uint32_t>();
+        meshlet.vertex_offset=reader.read<uint32_t>();
+        meshlet.vertex_count=reader.read<uint32_t>();
+        reader.readArray(meshlet.center.data(), 3);
+        meshlet.radius=reader.read<float>();
+        reader.readArray(meshlet.cone_axis.data(), 3);
+        meshlet.cone_cutoff=reader.read<float>();
+    }
+    if(!reader.isValid())
+        return false;
+
+    // batches must stay inside the triangles they belong to, and so must
+    // their meshlets inside the batch
+    auto checkBatches=[&](uint32_t batch_offset, uint32_t batch_count, uint32_t index_offset, uint32_t index_count){
+        if(uint64_t(batch_offset)+batch_count>batches.size() || uint64_t(index_offset)+index_count>header.index_count)
+            return false;
+        for(uint32_t b=batch_offset; b<batch_offset+batch_count; b++){
+            const DrawBatch& batch=batches[b];
+            if(batch.index_offset<index_offset
+                || uint64_t(batch.index_offset)+batch.index_count>uint64_t(index_offset)+index_count
+                || uint64_t(batch.meshlet_offset)+batch.meshlet_count>meshlets.size())
+                return false;
+            for(uint32_t m=batch.meshlet_offset; m<batch.meshlet_offset+batch.meshlet_count; m++)
+                if(meshlets[m].index_offset<batch.index_offset
+                    || uint64_t(meshlets[m].index_offset)+meshlets[m].index_count>uint64_t(batch.index_offset)+batch.index_count
+                    || uint64_t(meshlets[m].vertex_offset)+meshlets[m].vertex_count>header.meshlet_vertex_count)
+                    return false;
+        }
+        return true;
+    };
+    for(const auto& range: ranges){
+        if(!checkBatches(range.batch_offset, range.batch_count, range.index_offset, range.index_count))
+            return false;
+        if(range.lod_count==0 || uint64_t(range.lod_offset)+range.lod_count>lods.size())
+            return false;
+        for(uint32_t l=range.lod_offset; l<range.lod_offset+range.lod_count; l++)
+            if(!checkBatches(lods[l].batch_offset, lods[l].batch_count, lods[l].index_offset, lods[l].index_count)
+                || lods[l].vertex_count>range.vertex_count)
+                return false;
+    }
+
+    std::vector<tinyobj::material_t> cached_materials(reader.readCount(MATERIAL_MIN));
+    for(auto& material: cached_materials)
+        material=readMaterial(reader);
+    if(!reader.isValid())
+        return false;
+
+    // point the mesh into the mapping
+    const unsigned char* data=file->getData();
+    size_t vertex_count=static_cast<size_t>(header.vertex_count);
+    size_t index_count=static_cast<size_t>(header.index_count);
+    mesh=Mesh();
+    mesh.positions={reinterpret_cast<const float*>(data+header.positions_offset), vertex_count*3};
+    mesh.normals={reinterpret_cast<const float*>(data+header.normals_offset), vertex_count*3};
+    mesh.texcoords={reinterpret_cast<const float*>(data+header.texcoords_offset), vertex_count*2};
+    mesh.colors={reinterpret_cast<const float*>(data+header.colors_offset), vertex_count*3};
+    mesh.indices={reinterpret_cast<const uint32_t*>(data+header.indices_offset), index_count};
+    mesh.material_ids={reinterpret_cast<const int*>(data+header.material_ids_offset), index_count/3};
+    mesh.meshlet_vertices={reinterpret_cast<const uint32_t*>(data+header.meshlet_vertices_offset), static_cast<size_t>(header.meshlet_vertex_count)};
+    mesh.ranges=std::move(ranges);
+    mesh.batches=std::move(batches);
+    mesh.lods=std::move(lods);
+    mesh.meshlets=std::move(meshlets);
+    mesh.mapping=std::move(file);
+
+    // indices are trusted after this point
+    for(uint32_t index: mesh.indices){
+        if(index>=vertex_count){
+            mesh=Mesh();
+            return false;
+        }
+    }
+    for(uint32_t index: mesh.meshlet_vertices){
+        if(index>=vertex_count){
+            mesh=Mesh();
+            return false;
+        }
+    }
+
+    materials=std::move(cached_materials);
+    return true;
+}
+
+bool MeshCache::save(const std::string& obj_path, const Mesh& mesh, const std::vector<tinyobj::material_t>& materials)
+{
+    CacheWriter meta;
+    fs::path obj_dir=fs::path(obj_path).parent_path();
+    // the obj itself plus every mtllib it references
+    std::vector<std::string> names{fs::path(obj_path).filename().string()};
+    for(auto& name: findMaterialLibraries(obj_path))
+        names.push_back(std::move(name));
+
+    meta.write<uint32_t>(static_cast<uint32_t>(names.size()));
+    for(const auto& name: names){
+        fs::path path=obj_dir/name;
+        uint64_t size;
+        int64_t mtime;
+        if(!statFile(path, size, mtime))
+            return false;
+        meta.writeString(name);
+        meta.write(size);
+        meta.write(mtime);
+        meta.write(hashFile(path));
+    }
+
+    meta.write<uint32_t>(static_cast<uint32_t>(mesh.ranges.size()));
+    for(const auto& range: mesh.ranges){
+        meta.writeString(range.name);
+        meta.write(range.vertex_offset);
+        meta.write(range.vertex_count);
+        meta.write(range.index_offset);
+        meta.write(range.index_count);
+        meta.write(range.batch_offset);
+        meta.write(range.batch_count);
+        meta.write(range.lod_offset);
+        meta.write(range.lod_count);
+        meta.writeArray(range.bounds_min.data(), 3);
+        meta.writeArray(range.bounds_max.data(), 3);
+    }
+
+    meta.write<uint32_t>(static_cast<uint32_t>(mesh.batches.size()));
+    for(const auto& batch: mesh.batches){
+        meta.write(batch.index_offset);
+        meta.write(batch.index_count);
+        meta.write<int32_t>(batch.material_id);
+        meta.write(batch.meshlet_offset);
+        meta.write(batch.meshlet_count);
+    }
+
+    meta.write<uint32_t>(static_cast<uint32_t>(mesh.lods.size()));
+    for(const auto& lod: mesh.lods){
+        meta.write(lod.index_offset);
+        meta.write(lod.index_count);
+        meta.write(lod.batch_offset);
+        meta.write(lod.batch_count);
+        meta.write(lod.vertex_count);
+        meta.write(lod.error);
+    }
+
+    meta.write<uint32_t>(static_cast<uint32_t>(mesh.meshlets.size()));
+    for(const auto& meshlet: mesh.meshlets){
+        meta.write(meshlet.index_offset);
+        meta.write(meshlet.index_count);
+        meta.write(meshlet.vertex_offset);
+        meta.write(meshlet.vertex_count);
+        meta.writeArray(meshlet.center.data(), 3);
+        meta.write(meshlet.radius);
+        meta.writeArray(meshlet.cone_axis.data(), 3);
+        meta.write(meshlet.cone_cutoff);
+    }
+
+    meta.write<uint32_t>(static_cast<uint32_t>(materials.size()));
+    for(const auto& material: materials)
+        writeMaterial(meta, material);
+
+    // header, metadata, then the streams at aligned offsets
+    CacheHeader header{};
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version=VERSION;
+    header.endian=CACHE_ENDIAN;
+    header.vertex_count=mesh.getVertexCount();
+    header.index_count=mesh.indices.size();
+    header.meshlet_vertex_count=mesh.meshlet_vertices.size();
+
+    CacheWriter writer;
+    writer.write(header);
+    header.meta_offset=writer.size();
+    header.meta_size=meta.size();
+    writer.data().append(meta.data());
+
+    auto writeStream=[&](uint64_t& offset, auto stream){
+        writer.align();
+        offset=writer.size();
+        writer.writeArray(stream.data(), stream.size());
+    };
+    writeStream(header.positions_offset, mesh.positions);
+    writeStream(header.normals_offset, mesh.normals);
+    writeStream(header.texcoords_offset, mesh.texcoords);
+    writeStream(header.colors_offset, mesh.colors);
+    writeStream(header.indices_offset, mesh.indices);
+    writeStream(header.material_ids_offset, mesh.material_ids);
+    writeStream(header.meshlet_vertices_offset, mesh.meshlet_vertices);
+    header.file_size=writer.size();
+    memcpy(writer.data().data(), &header, sizeof(header));
+
+    // write aside and rename, a reader never sees a partial cache
+    std::string cache_path=getCachePath(obj_path);
+    std::string temp_path=cache_path+".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary|std::ios::trunc);
+        if(!file.write(writer.data().data(), writer.data().size()))
+            return false;
+    }
+
+    std::error_code error;
+    fs::rename(temp_path, cache_path, error);
+    if(error){
+        fs::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
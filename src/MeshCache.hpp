@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Mesh.hpp"
+
+#include <string>
+#include <vector>
+
+// Versioned binary cache of a built Mesh and its materials, written next to
+// the obj as "<file>.mesh". A cache is valid while the obj and its mtl files
+// keep their size and mtime; if only the mtime changed, a content hash
+// decides. The levels of detail and meshlets are stored with the mesh, so
+// simplifying and clustering only happen when the cache is built. Loading
+// maps the file and points the mesh streams into it, so nothing is parsed
+// or copied apart from the draw ranges and materials.
+class MeshCache{
+public:
+    static constexpr uint32_t VERSION=4;
+
+    static std::string getCachePath(const std::string& obj_path);
+
+    // mtllib names of an obj, header_only stops at the first face
+    static std::vector<std::string> findMaterialLibraries(const std::string& obj_path, bool header_only=false);
+    static bool load(const std::string& obj_path, Mesh& mesh, std::vector<tinyobj::material_t>& materials);
+    static bool save(const std::string& obj_path, const Mesh& mesh, const std::vector<tinyobj::material_t>& materials);
+};
@@ -1,14 +1,35 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 
 #include "Model.hpp"
+#include "MeshCache.hpp"
 
 #include <cstddef>
+#include <fstream>
 #include <iostream>
+#include <utility>
 
-Model::Model(const std::string& filepath)
+Model::Model(const std::string& filepath, TextureFormat texture_format)
 {
-    readModel(filepath);
-    readTextures(filepath);
+    std::map<std::string, TextureFuture> pending;
+    if(MeshCache::load(filepath, mesh, materials)){
+        requestTextures(filepath, materials, texture_format, pending);
+    }else{
+        // textures named in the mtl files decode on the pool while the obj parses
+        requestTextures(filepath, readMaterials(filepath), texture_format, pending);
+        readModel(filepath);
+        requestTextures(filepath, materials, texture_format, pending);
+    }
+
+    for(auto& [name, future]: pending)
+        if(TextureHandle texture=future.get())
+            textures[name]=std::move(texture);
+    buildMaterialTable();
+}
+
+Model::Model(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, std::vector<tinyobj::material_t> materials)
+: mesh(attrib, shapes), materials(std::move(materials))
+{
+    buildMaterialTable();
 }
 
 void Model::readModel(const std::string& filepath)
@@ -34,37 +55,93 @@ void Model::readModel(const std::string& filepath)
         std::cerr<<"TinyObjReader2: "<<reader.Error()<<std::endl;
     }
 
-    // read properties
-    attrib=reader.GetAttrib();
-    shapes=reader.GetShapes();
+    // build the indexed mesh, the obj attributes are not kept
+    mesh=Mesh(reader.GetAttrib(), reader.GetShapes());
     materials=reader.GetMaterials();
+
+    if(!MeshCache::save(filepath, mesh, materials))
+        std::cerr<<"Failed to write mesh cache "<<MeshCache::getCachePath(filepath)<<std::endl;
 }
 
-void Model::readTextures(const std::string& filepath)
+std::vector<tinyobj::material_t> Model::readMaterials(const std::string& filepath)
 {
     size_t file_pos=filepath.find_last_of('/');
     std::string file_dir=filepath.substr(0,file_pos+1);
 
-    for(auto& material: materials){
-        if(!material.diffuse_texname.empty())
-            textures[material.diffuse_texname]=new Texture(file_dir+material.diffuse_texname, TextureType::DIFFUSE);
+    // only the mtllib lines before the first face, the full parse catches the rest
+    std::vector<tinyobj::material_t> materials;
+    std::map<std::string, int> material_map;
+    for(const auto& name: MeshCache::findMaterialLibraries(filepath, true)){
+        std::ifstream file(file_dir+name);
+        std::string warning, error;
+        if(file)
+            tinyobj::LoadMtl(&material_map, &materials, &file, &warning, &error);
+    }
+    return materials;
+}
 
-        if(!material.specular_texname.empty())
-            textures[material.specular_texname]=new Texture(file_dir+material.specular_texname, TextureType::SPECULAR);
+void Model::requestTextures(const std::string& filepath, const std::vector<tinyobj::material_t>& materials,
+    TextureFormat texture_format, std::map<std::string, TextureFuture>& pending)
+{
+    size_t file_pos=filepath.find_last_of('/');
+    std::string file_dir=filepath.substr(0,file_pos+1);
 
-        if(!material.bump_texname.empty())
-            textures[material.bump_texname]=new Texture(file_dir+material.bump_texname, TextureType::BUMP);
+    auto request=[&](const std::string& name, TextureType type){
+        if(!name.empty() && !pending.contains(name))
+            pending[name]=AssetManager::loadTextureAsync(file_dir+name, type, texture_format);
+    };
+    for(auto& material: materials){
+        request(material.diffuse_texname, TextureType::DIFFUSE);
+        request(material.specular_texname, TextureType::SPECULAR);
+        request(material.bump_texname, TextureType::BUMP);
     }
 }
 
-void Model::setTextures(const std::map<std::string, Texture*>& textures)
+void Model::setTextures(const std::map<std::string, TextureHandle>& textures)
 {
     this->textures=textures;
+    buildMaterialTable();
 }
 
-void Model::addTextures(const std::string& filepath, TextureType type)
+void Model::addTextures(const std::string& filepath, TextureType type, TextureFormat texture_format)
 {
     size_t file_pos=filepath.find_last_of('/');
     std::string file_name=filepath.substr(file_pos+1);
-    textures[file_name]=new Texture(filepath, type);
+    if(TextureHandle texture=AssetManager::loadTexture(filepath, type, texture_format))
+        textures[file_name]=std::move(texture);
+    buildMaterialTable();
+}
+
+void Model::buildMaterialTable()
+{
+    // textures that failed to load are missing from the map
+    auto find=[&](const std::string& name)->TextureHandle{
+        auto texture=textures.find(name);
+        return texture!=textures.end() ? texture->second : nullptr;
+    };
+
+    material_table.clear();
+    material_table.reserve(materials.size()+1);
+    for(const auto& source: materials){
+        Material material;
+        material.name=source.name;
+        material.ambient=vec3f_t(source.ambient[0], source.ambient[1], source.ambient[2]);
+        material.diffuse=vec3f_t(source.diffuse[0], source.diffuse[1], source.diffuse[2]);
+        material.specular=vec3f_t(source.specular[0], source.specular[1], source.specular[2]);
+        material.diffuse_texture=find(source.diffuse_texname);
+        material.specular_texture=find(source.specular_texname);
+        material.bump_texture=find(source.bump_texname);
+        material_table.push_back(std::move(material));
+    }
+
+    // faces without a material use textures added to the model by type
+    Material fallback;
+    for(const auto& [name, texture]: textures){
+        switch(texture->getTextureType()){
+        case DIFFUSE:  fallback.diffuse_texture=texture; break;
+        case SPECULAR: fallback.specular_texture=texture; break;
+        case BUMP:     fallback.bump_texture=texture; break;
+        }
+    }
+    material_table.push_back(std::move(fallback));
 }
@@ -1,24 +1,42 @@
 #pragma once
 
 #include "tiny_obj_loader.h"
+#include "AssetManager.hpp"
+#include "Material.hpp"
+#include "Mesh.hpp"
 #include "Texture.hpp"
 
+#include <map>
+
 class Model{
 private:
-    tinyobj::attrib_t                attrib;
-    std::vector<tinyobj::shape_t>    shapes;
+    Mesh                             mesh;
     std::vector<tinyobj::material_t> materials;
-    std::map<std::string, Texture*>  textures;
+    std::map<std::string, TextureHandle> textures;
+    // one record per obj material plus the fallback for id -1 at the end
+    std::vector<Material>            material_table=std::vector<Material>(1);
 
+    void buildMaterialTable();
     void readModel(const std::string& filepath);
-    void readTextures(const std::string& filepath);
-    
+    std::vector<tinyobj::material_t> readMaterials(const std::string& filepath);
+    void requestTextures(const std::string& filepath, const std::vector<tinyobj::material_t>& materials,
+        TextureFormat texture_format, std::map<std::string, TextureFuture>& pending);
+
 public:
     Model()=default;
-    Model(const std::string& filepath);
+    Model(const std::string& filepath, TextureFormat texture_format=TextureFormat::RGBA8);
+    Model(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, std::vector<tinyobj::material_t> materials={});
+
+    const Mesh& getMesh() const {return mesh;}
+
+    // resolved material for a mesh material id, -1 and unknown ids give the fallback
+    const Material& getMaterial(int id) const
+    {
+        return id>=0 && id<static_cast<int>(material_table.size())-1 ? material_table[id] : material_table.back();
+    }
 
-    void setTextures(const std::map<std::string, Texture*>& textures);
-    void addTextures(const std::string& filepath, TextureType type);
+    void setTextures(const std::map<std::string, TextureHandle>& textures);
+    void addTextures(const std::string& filepath, TextureType type, TextureFormat texture_format=TextureFormat::RGBA8);
 
 friend class Shader;
 };
@@ -0,0 +1,269 @@
+#include "Profiler.hpp"
+#include "Rasterizer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+bool Profiler::enabled=true;
+Profiler::profile_clock::time_point Profiler::frame_start=Profiler::profile_clock::now();
+std::array<std::atomic<double>, Profiler::STAGE_COUNT> Profiler::stage_ms{};
+std::mutex Profiler::blocks_mutex;
+std::vector<Profiler::CounterBlock*> Profiler::counter_blocks;
+std::array<uint64_t, Profiler::COUNTER_COUNT> Profiler::retired_counters{};
+std::array<uint64_t, Profiler::COUNTER_COUNT> Profiler::frame_counters{};
+std::array<Profiler::Frame, Profiler::HISTORY> Profiler::history{};
+int Profiler::head=0;
+int Profiler::size=0;
+
+Profiler::CounterBlock::CounterBlock()
+{
+    std::lock_guard lock(blocks_mutex);
+    counter_blocks.push_back(this);
+}
+
+Profiler::CounterBlock::~CounterBlock()
+{
+    // the counts of an exiting thread stay in the totals
+    std::lock_guard lock(blocks_mutex);
+    for(int i=0; i<COUNTER_COUNT; i++)
+        retired_counters[i]+=values[i].load(std::memory_order_relaxed);
+    counter_blocks.erase(std::find(counter_blocks.begin(), counter_blocks.end(), this));
+}
+
+Profiler::CounterBlock& Profiler::threadCounters()
+{
+    static thread_local CounterBlock block;
+    return block;
+}
+
+std::array<uint64_t, Profiler::COUNTER_COUNT> Profiler::sumCounters()
+{
+    std::lock_guard lock(blocks_mutex);
+    std::array<uint64_t, COUNTER_COUNT> sum=retired_counters;
+    for(const CounterBlock* block: counter_blocks)
+        for(int i=0; i<COUNTER_COUNT; i++)
+            sum[i]+=block->values[i].load(std::memory_order_relaxed);
+    return sum;
+}
+
+void Profiler::beginFrame()
+{
+    frame_start=profile_clock::now();
+    for(auto& ms: stage_ms)
+        ms.store(0.0, std::memory_order_relaxed);
+    // blocks are never reset, their owners may still be counting; the
+    // frame's counts are the growth of the totals from here
+    frame_counters=sumCounters();
+}
+
+void Profiler::endFrame()
+{
+    if(!enabled)
+        return;
+
+    Frame& frame=history[head];
+    frame.frame_ms=std::chrono::duration<double, std::milli>(profile_clock::now()-frame_start).count();
+    for(int i=0; i<STAGE_COUNT; i++)
+        frame.stage_ms[i]=stage_ms[i].load(std::memory_order_relaxed);
+    std::array<uint64_t, COUNTER_COUNT> totals=sumCounters();
+    for(int i=0; i<COUNTER_COUNT; i++)
+        frame.counters[i]=totals[i]-frame_counters[i];
+
+    head=(head+1)%HISTORY;
+    size=std::min(size+1, HISTORY);
+}
+
+const Profiler::Frame& Profiler::getFrame(int age)
+{
+    return history[(head-1-age+HISTORY)%HISTORY];
+}
+
+static double percentileOf(std::vector<double>& values, double p)
+{
+    if(values.empty())
+        return 0.0;
+    size_t index=static_cast<size_t>(p*(values.size()-1)+0.5);
+    std::nth_element(values.begin(), values.begin()+index, values.end());
+    return values[index];
+}
+
+double Profiler::getFramePercentile(double p)
+{
+    std::vector<double> values(size);
+    for(int i=0; i<size; i++)
+        values[i]=getFrame(i).frame_ms;
+    return percentileOf(values, p);
+}
+
+double Profiler::getStagePercentile(ProfileStage stage, double p)
+{
+    std::vector<double> values(size);
+    for(int i=0; i<size; i++)
+        values[i]=getFrame(i).stage_ms[static_cast<int>(stage)];
+    return percentileOf(values, p);
+}
+
+bool Profiler::exportCsv(const std::string& path)
+{
+    FILE* file=fopen(path.c_str(), "w");
+    if(file==nullptr)
+        return false;
+
+    fprintf(file, "frame,frame_ms");
+    for(int s=0; s<STAGE_COUNT; s++)
+        fprintf(file, ",%s_ms", getStageName(static_cast<ProfileStage>(s)));
+    for(int c=0; c<COUNTER_COUNT; c++)
+        fprintf(file, ",%s", getCounterName(static_cast<ProfileCounter>(c)));
+    fprintf(file, "\n");
+
+    // oldest frame first
+    for(int i=size-1; i>=0; i--){
+        const Frame& frame=getFrame(i);
+        fprintf(file, "%d,%.4f", size-1-i, frame.frame_ms);
+        for(double ms: frame.stage_ms)
+            fprintf(file, ",%.4f", ms);
+        for(uint64_t n: frame.counters)
+            fprintf(file, ",%llu", static_cast<unsigned long long>(n));
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+    return true;
+}
+
+const char* Profiler::getStageName(ProfileStage stage)
+{
+    switch(stage){
+    case ProfileStage::CLEAR:     return "clear";
+    case ProfileStage::FLUSH:     return "flush";
+    case ProfileStage::TRANSFORM: return "transform";
+    case ProfileStage::RENDER:    return "render";
+    case ProfileStage::RASTERIZE: return "rasterize";
+    case ProfileStage::LIGHTING:  return "lighting";
+    case ProfileStage::RESOLVE:   return "resolve";
+    case ProfileStage::UPLOAD:    return "upload";
+    default:                      return "unknown";
+    }
+}
+
+const char* Profiler::getCounterName(ProfileCounter counter)
+{
+    switch(counter){
+    case ProfileCounter::TRIANGLES_SUBMITTED:  return "triangles_submitted";
+    case ProfileCounter::TRIANGLES_CULLED:     return "triangles_culled";
+    case ProfileCounter::TRIANGLES_CLIPPED:    return "triangles_clipped";
+    case ProfileCounter::TRIANGLES_RASTERIZED: return "triangles_rasterized";
+    case ProfileCounter::FRAGMENTS_SHADED:     return "fragments_shaded";
+    case ProfileCounter::SHAPES_CULLED:        return "shapes_culled";
+    case ProfileCounter::INSTANCES_CULLED:     return "instances_culled";
+    case ProfileCounter::MESHLETS_CULLED:      return "meshlets_culled";
+    case ProfileCounter::LIGHTS_SUBMITTED:     return "lights_submitted";
+    case ProfileCounter::TILE_LIGHTS:          return "tile_lights";
+    default:                                   return "unknown";
+    }
+}
+
+// 3x5 bitmap font, one bit per pixel, top row in the highest bits
+static uint16_t glyph(char c)
+{
+    static const std::pair<char, uint16_t> font[]={
+        {' ', 0x0000}, {'%', 0x52a5}, {'-', 0x01c0}, {'.', 0x0002}, {'/', 0x12a4}, {'0', 0x7b6f},
+        {'1', 0x2c97}, {'2', 0x73e7}, {'3', 0x73cf}, {'4', 0x5bc9}, {'5', 0x79cf}, {'6', 0x79ef},
+        {'7', 0x7252}, {'8', 0x7bef}, {'9', 0x7bcf}, {':', 0x0410}, {'A', 0x2bed}, {'B', 0x6bae},
+        {'C', 0x3923}, {'D', 0x6b6e}, {'E', 0x79a7}, {'F', 0x79a4}, {'G', 0x396b}, {'H', 0x5bed},
+        {'I', 0x7497}, {'J', 0x126a}, {'K', 0x5bad}, {'L', 0x4927}, {'M', 0x5fed}, {'N', 0x6b6d},
+        {'O', 0x2b6a}, {'P', 0x6ba4}, {'Q', 0x2b73}, {'R', 0x6bad}, {'S', 0x388e}, {'T', 0x7492},
+        {'U', 0x5b6f}, {'V', 0x5b6a}, {'W', 0x5bfd}, {'X', 0x5aad}, {'Y', 0x5a92}, {'Z', 0x72a7},
+    };
+
+    if(c>='a' && c<='z')
+        c=c-'a'+'A';
+    for(const auto& [ch, bits]: font)
+        if(ch==c)
+            return bits;
+    return 0;
+}
+
+static void drawText(Rasterizer& rasterizer, int x, int y, const char* text, const color_t& color, int scale=2)
+{
+    for(; *text; text++, x+=4*scale){
+        uint16_t bits=glyph(*text);
+        for(int row=0; row<5; row++)
+            for(int col=0; col<3; col++)
+                if(bits&(1<<(14-row*3-col)))
+                    for(int i=0; i<scale; i++)
+                        for(int j=0; j<scale; j++)
+                            rasterizer.setPixel(x+col*scale+i, y+row*scale+j, color);
+    }
+}
+
+static void fillRect(Rasterizer& rasterizer, int x, int y, int w, int h, const color_t& color)
+{
+    for(int j=y; j<y+h; j++)
+        for(int i=x; i<x+w; i++)
+            rasterizer.setPixel(i, j, color);
+}
+
+void Profiler::drawOverlay(Rasterizer& rasterizer)
+{
+    if(!enabled || size==0)
+        return;
+
+    static const color_t colors[STAGE_COUNT]={
+        {0.6f, 0.6f, 0.6f}, {0.9f, 0.6f, 0.2f}, {0.9f, 0.9f, 0.2f},
+        {0.3f, 0.8f, 0.3f}, {0.3f, 0.6f, 1.0f}, {0.3f, 0.9f, 0.9f},
+        {0.9f, 0.4f, 0.5f}, {0.8f, 0.4f, 0.9f},
+    };
+    const color_t white(1.f, 1.f, 1.f);
+    const int x0=8, y0=8, line=14, width=420;
+    const float ms_to_px=8.f;
+
+    char text[96];
+    fillRect(rasterizer, x0, y0, width, line*(STAGE_COUNT+7)+8, color_t(0.1f, 0.1f, 0.1f));
+
+    int y=y0+6;
+    double frame_median=getFramePercentile(0.5);
+    snprintf(text, sizeof(text), "FRAME %.2f MS  P95 %.2f  %.0f FPS", frame_median, getFramePercentile(0.95),
+        frame_median>0.0 ? 1000.0/frame_median : 0.0);
+    drawText(rasterizer, x0+6, y, text, white);
+    y+=line;
+
+    // stage rows: rolling median and p95 with a bar scaled to the median
+    for(int s=0; s<STAGE_COUNT; s++){
+        ProfileStage stage=static_cast<ProfileStage>(s);
+        double median=getStagePercentile(stage, 0.5);
+        snprintf(text, sizeof(text), "%-9s %6.2f %6.2f", getStageName(stage), median, getStagePercentile(stage, 0.95));
+        drawText(rasterizer, x0+6, y, text, colors[s]);
+
+        int bar=std::min(static_cast<int>(median*ms_to_px), width-220);
+        fillRect(rasterizer, x0+212, y, bar, 10, colors[s]);
+        y+=line;
+    }
+
+    const Frame& last=getFrame(0);
+    snprintf(text, sizeof(text), "TRIS %llu  CULLED %llu",
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::TRIANGLES_SUBMITTED)]),
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::TRIANGLES_CULLED)]));
+    drawText(rasterizer, x0+6, y, text, white);
+    y+=line;
+    snprintf(text, sizeof(text), "RASTER %llu  FRAGS %llu",
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::TRIANGLES_RASTERIZED)]),
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::FRAGMENTS_SHADED)]));
+    drawText(rasterizer, x0+6, y, text, white);
+    y+=line;
+    snprintf(text, sizeof(text), "CLIPPED %llu  SHAPES CULLED %llu",
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::TRIANGLES_CLIPPED)]),
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::SHAPES_CULLED)]));
+    drawText(rasterizer, x0+6, y, text, white);
+    y+=line;
+    snprintf(text, sizeof(text), "INSTANCES CULLED %llu  MESHLETS CULLED %llu",
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::INSTANCES_CULLED)]),
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::MESHLETS_CULLED)]));
+    drawText(rasterizer, x0+6, y, text, white);
+    y+=line;
+    snprintf(text, sizeof(text), "LIGHTS %llu  TILE LIGHTS %llu",
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::LIGHTS_SUBMITTED)]),
+        static_cast<unsigned long long>(last.counters[static_cast<int>(ProfileCounter::TILE_LIGHTS)]));
+    drawText(rasterizer, x0+6, y, text, white);
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Rasterizer;
+
+enum class ProfileStage{
+    CLEAR,
+    FLUSH,
+    TRANSFORM,
+    RENDER,
+    RASTERIZE,
+    LIGHTING,
+    RESOLVE,
+    UPLOAD,
+    COUNT
+};
+
+enum class ProfileCounter{
+    TRIANGLES_SUBMITTED,
+    TRIANGLES_CULLED,
+    TRIANGLES_CLIPPED,
+    TRIANGLES_RASTERIZED,
+    FRAGMENTS_SHADED,
+    SHAPES_CULLED,
+    INSTANCES_CULLED,
+    MESHLETS_CULLED,
+    LIGHTS_SUBMITTED,
+    TILE_LIGHTS,            // light-tile pairs left after depth culling
+    COUNT
+};
+
+// Per-frame stage timings and counters, kept for the last HISTORY frames.
+// beginFrame/endFrame and the history accessors belong to the thread
+// driving the frame; stage times and counters may be added from any
+// thread and land in whichever frame is open at that moment. Every thread
+// counts into a block of its own, which endFrame adds up, so contexts
+// rendering on different threads never count on a shared cache line.
+class Profiler{
+public:
+    static constexpr int HISTORY=240;
+    static constexpr int STAGE_COUNT=static_cast<int>(ProfileStage::COUNT);
+    static constexpr int COUNTER_COUNT=static_cast<int>(ProfileCounter::COUNT);
+
+    struct Frame{
+        double                               frame_ms;
+        std::array<double, STAGE_COUNT>      stage_ms;
+        std::array<uint64_t, COUNTER_COUNT>  counters;
+    };
+
+private:
+    using profile_clock=std::chrono::steady_clock;
+
+    // only its own thread writes a block, the totals only ever grow
+    struct alignas(64) CounterBlock{
+        std::array<std::atomic<uint64_t>, COUNTER_COUNT> values{};
+
+        CounterBlock();
+        ~CounterBlock();
+    };
+
+    static bool                                              enabled;
+    static profile_clock::time_point                         frame_start;
+    static std::array<std::atomic<double>, STAGE_COUNT>      stage_ms;
+    static std::mutex                                        blocks_mutex;
+    static std::vector<CounterBlock*>                        counter_blocks;
+    static std::array<uint64_t, COUNTER_COUNT>               retired_counters;  // of threads that exited
+    static std::array<uint64_t, COUNTER_COUNT>               frame_counters;    // totals when the frame began
+    static std::array<Frame, HISTORY>                        history;
+    static int                                               head;
+    static int                                               size;
+
+    static CounterBlock&                       localCounters();
+    static CounterBlock&                       threadCounters();
+    static std::array<uint64_t, COUNTER_COUNT> sumCounters();
+
+public:
+    static void setEnabled(bool enabled) {Profiler::enabled=enabled;}
+    static bool isEnabled()              {return enabled;}
+
+    static void beginFrame();
+    static void endFrame();
+    static void addTime(ProfileStage stage, double ms);
+    static void count(ProfileCounter counter, uint64_t n=1);
+
+    static int          getFrameCount() {return size;}
+    static const Frame& getFrame(int age);
+    static double       getFramePercentile(double p);
+    static double       getStagePercentile(ProfileStage stage, double p);
+
+    static bool exportCsv(const std::string& path);
+    static void drawOverlay(Rasterizer& rasterizer);
+
+    static const char* getStageName(ProfileStage stage);
+    static const char* getCounterName(ProfileCounter counter);
+};
+
+// adds the lifetime of the scope to a stage of the current frame
+class ProfileScope{
+private:
+    ProfileStage                          stage;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    ProfileScope(ProfileStage stage)
+    : stage(stage), start(std::chrono::steady_clock::now())
+    { }
+
+    ~ProfileScope()
+    {
+        if(Profiler::isEnabled())
+            Profiler::addTime(stage, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count());
+    }
+};
+
+inline void Profiler::addTime(ProfileStage stage, double ms)
+{
+    stage_ms[static_cast<int>(stage)].fetch_add(ms, std::memory_order_relaxed);
+}
+
+inline Profiler::CounterBlock& Profiler::localCounters()
+{
+    // a plain pointer keeps the thread_local guard of the block itself off
+    // the counting path
+    static thread_local CounterBlock* block=nullptr;
+    if(!block)
+        block=&threadCounters();
+    return *block;
+}
+
+inline void Profiler::count(ProfileCounter counter, uint64_t n)
+{
+    // the only writer of the block, no read-modify-write is needed
+    auto& value=localCounters().values[static_cast<int>(counter)];
+    value.store(value.load(std::memory_order_relaxed)+n, std::memory_order_relaxed);
+}
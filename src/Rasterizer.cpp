@@ -1,30 +1,74 @@
 #include "Rasterizer.hpp"
-#include "Shader.hpp"
+#include "Color.hpp"
+#include "Coverage.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iostream>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 Rasterizer::Rasterizer(int width, int height)
-: width(width), height(height),
-  frame_buffer(width*height, {0.f, 0.f, 0.f}),
-  z_buffer(width*height, std::numeric_limits<float>::max())
-{ }
+: tiles_x((width+TILE_SIZE-1)/TILE_SIZE), tiles_y((height+TILE_SIZE-1)/TILE_SIZE),
+  tile_bins(tiles_x*tiles_y),
+  tile_light_bins(tiles_x*tiles_y), tile_lights(tiles_x*tiles_y),
+  width(width), height(height),
+  color_buffer(width*height, packSrgb({0.f, 0.f, 0.f})),
+  z_buffer(width*height, std::numeric_limits<float>::max()),
+  hiz_width((width+Coverage::BLOCK_SIZE-1)/Coverage::BLOCK_SIZE),
+  hiz_height((height+Coverage::BLOCK_SIZE-1)/Coverage::BLOCK_SIZE),
+  hiz_min(hiz_width*hiz_height, std::numeric_limits<float>::max()),
+  hiz_max(hiz_width*hiz_height, std::numeric_limits<float>::max())
+{
+    color_target=color_buffer.data();
+    hiz_writes.assign(hiz_width*hiz_height, 0);
+}
 
 void Rasterizer::clear()
 {
-    std::fill(frame_buffer.begin(), frame_buffer.end(), color_t{0.f, 0.f, 0.f});
-    std::fill(z_buffer.begin(), z_buffer.end(), std::numeric_limits<float>::max());
+    clear(color_t{0.f, 0.f, 0.f});
 }
 
 void Rasterizer::clear(color_t color)
 {
-    std::fill(frame_buffer.begin(), frame_buffer.end(), color);
-    std::fill(z_buffer.begin(), z_buffer.end(), std::numeric_limits<float>::max());
+    clear_color=packSrgb(color);
+    if(shading_mode!=ShadingMode::DEPTH_ONLY)
+        std::fill(color_target, color_target+width*height, clear_color);
+    if(getSamples()==1)
+        std::fill(z_buffer.begin(), z_buffer.end(), std::numeric_limits<float>::max());
+    std::fill(hiz_min.begin(), hiz_min.end(), std::numeric_limits<float>::max());
+    std::fill(hiz_max.begin(), hiz_max.end(), std::numeric_limits<float>::max());
+    if(shading_mode==ShadingMode::DEFERRED)
+        gbuffer.clear();
 }
 
 void Rasterizer::resize(int width, int height)
 {
     this->width=width;
     this->height=height;
-    frame_buffer.resize(width*height, {0.f, 0.f, 0.f});
-    z_buffer.resize(width*height, std::numeric_limits<float>::max());
+    // an external target no longer fits
+    color_buffer.resize(width*height, packSrgb({0.f, 0.f, 0.f}));
+    color_target=color_buffer.data();
+    allocateSamples();
+
+    hiz_width=(width+Coverage::BLOCK_SIZE-1)/Coverage::BLOCK_SIZE;
+    hiz_height=(height+Coverage::BLOCK_SIZE-1)/Coverage::BLOCK_SIZE;
+    hiz_min.assign(hiz_width*hiz_height, std::numeric_limits<float>::max());
+    hiz_max.assign(hiz_width*hiz_height, std::numeric_limits<float>::max());
+    hiz_writes.assign(hiz_width*hiz_height, 0);
+
+    tiles_x=(width+TILE_SIZE-1)/TILE_SIZE;
+    tiles_y=(height+TILE_SIZE-1)/TILE_SIZE;
+    tile_bins.assign(tiles_x*tiles_y, {});
+    tile_light_bins.assign(tiles_x*tiles_y, {});
+    tile_lights.assign(tiles_x*tiles_y, {});
+
+    if(shading_mode==ShadingMode::DEFERRED)
+        gbuffer.resize(width*height);
 }
 
 void Rasterizer::setPixel(int x, int y, const color_t &color)
@@ -33,7 +77,7 @@ void Rasterizer::setPixel(int x, int y, const color_t &color)
         return;
 
     int index=y*width+x;
-    frame_buffer[index]=color;
+    color_target[index]=packSrgb(color);
 }
 
 void Rasterizer::setPixel(const vertex_t& point, const color_t& color)
@@ -45,20 +89,23 @@ void Rasterizer::setPixel(const vertex_t& point, const color_t& color)
         return;
 
     int index=y*width+x;
-    frame_buffer[index]=color;
+    color_target[index]=packSrgb(color);
 }
 
-bool Rasterizer::setDepth(int x, int y, int z)
+bool Rasterizer::setDepth(int x, int y, float z)
 {
-    int index=getIndex(x, y);
-    if(index>z_buffer.size()){
+    if(x>=width || y>=height || x<0 || y<0)
         return false;
-    }else if(z>z_buffer[index]){
+
+    int index=getIndex(x, y);
+    if(z>z_buffer[index])
         return false;
-    }else{
-        z_buffer[index]=index;
-        return true;
-    }
+
+    // the block maximum stays conservative, the minimum has to be exact
+    int block=(y/Coverage::BLOCK_SIZE)*hiz_width+x/Coverage::BLOCK_SIZE;
+    hiz_min[block]=std::min(hiz_min[block], z);
+    z_buffer[index]=z;
+    return true;
 }
 
 int Rasterizer::getIndex(int x, int y) const
@@ -68,7 +115,224 @@ int Rasterizer::getIndex(int x, int y) const
 
 void* Rasterizer::getFramebufferData()
 {
-    return frame_buffer.data();
+    return color_target;
+}
+
+void Rasterizer::setShadingMode(ShadingMode mode)
+{
+    // the G-buffer only exists while it is used
+    shading_mode=mode;
+    if(mode==ShadingMode::DEFERRED)
+        gbuffer.resize(width*height);
+    else
+        gbuffer=GBuffer();
+    allocateSamples();
+}
+
+void Rasterizer::setSampleCount(int samples)
+{
+    if(samples!=1 && samples!=2 && samples!=4 && samples!=8){
+        std::cerr<<"Unsupported sample count "<<samples<<std::endl;
+        return;
+    }
+    sample_count=samples;
+    allocateSamples();
+}
+
+void Rasterizer::setColorTarget(uint32_t* target)
+{
+    color_target=target ? target : color_buffer.data();
+}
+
+void Rasterizer::allocateSamples()
+{
+    // sample buffers start out cleared, the previous contents are dropped
+    int samples=getSamples();
+    z_buffer.assign(width*height*samples, std::numeric_limits<float>::max());
+    if(samples>1)
+        sample_colors.assign(width*height*samples, packSrgb({0.f, 0.f, 0.f}));
+    else
+        sample_colors=std::vector<uint32_t>();
+    std::fill(hiz_min.begin(), hiz_min.end(), std::numeric_limits<float>::max());
+    std::fill(hiz_max.begin(), hiz_max.end(), std::numeric_limits<float>::max());
+}
+
+uint64_t Rasterizer::testSamples(int bx, int by, uint64_t pixels, uint64_t full, const uint8_t* coverage,
+    const DepthPlane& plane, bool visible, SampleWrites& writes)
+{
+    const int samples=getSamples();
+    const uint32_t all=(1u<<samples)-1;
+    float row_z=plane.z+plane.dz_dx*(bx-plane.x)+plane.dz_dy*(by-plane.y);
+    writes.common=all;
+
+#if defined(__AVX2__)
+    // one lane per sample, lanes of uncovered samples are neither read nor written
+    const __m256i bits=_mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256 offsets=_mm256_loadu_ps(plane.sample_dz);
+    __m256 min_z=_mm256_set1_ps(std::numeric_limits<float>::max());
+    __m256 max_z=_mm256_set1_ps(std::numeric_limits<float>::lowest());
+#else
+    writes.min_z=std::numeric_limits<float>::max();
+    writes.max_z=std::numeric_limits<float>::lowest();
+#endif
+
+    uint64_t result=0;
+    while(pixels){
+        int bit=std::countr_zero(pixels);
+        pixels&=pixels-1;
+
+        int i=bit%Coverage::BLOCK_SIZE, j=bit/Coverage::BLOCK_SIZE;
+        float z=row_z+plane.dz_dx*i+plane.dz_dy*j;
+        uint32_t covered=(full>>bit)&1 ? all : coverage[bit];
+        float* stored=&z_buffer[getIndex(bx+i, by+j)*samples];
+
+#if defined(__AVX2__)
+        __m256i lanes=_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(covered), bits), bits);
+        __m256 sample_z=_mm256_add_ps(_mm256_set1_ps(z), offsets);
+        if(!visible){
+            __m256 old_z=_mm256_maskload_ps(stored, lanes);
+            lanes=_mm256_and_si256(lanes, _mm256_castps_si256(_mm256_cmp_ps(sample_z, old_z, _CMP_LE_OQ)));
+        }
+        _mm256_maskstore_ps(stored, lanes, sample_z);
+        min_z=_mm256_blendv_ps(min_z, _mm256_min_ps(min_z, sample_z), _mm256_castsi256_ps(lanes));
+        max_z=_mm256_blendv_ps(max_z, _mm256_max_ps(max_z, sample_z), _mm256_castsi256_ps(lanes));
+        uint32_t mask=_mm256_movemask_ps(_mm256_castsi256_ps(lanes));
+#else
+        uint32_t mask=0;
+        for(int s=0; s<samples; s++){
+            if(!(covered&(1u<<s)))
+                continue;
+            float sample_z=z+plane.sample_dz[s];
+            if(!visible && sample_z>stored[s])
+                continue;
+            stored[s]=sample_z;
+            writes.min_z=std::min(writes.min_z, sample_z);
+            writes.max_z=std::max(writes.max_z, sample_z);
+            mask|=1u<<s;
+        }
+#endif
+        writes.passed[bit]=static_cast<uint8_t>(mask);
+        writes.common&=mask;
+        if(mask)
+            result|=1ull<<bit;
+    }
+
+#if defined(__AVX2__)
+    __m128 lo=_mm_min_ps(_mm256_castps256_ps128(min_z), _mm256_extractf128_ps(min_z, 1));
+    __m128 hi=_mm_max_ps(_mm256_castps256_ps128(max_z), _mm256_extractf128_ps(max_z, 1));
+    lo=_mm_min_ps(lo, _mm_movehl_ps(lo, lo));
+    hi=_mm_max_ps(hi, _mm_movehl_ps(hi, hi));
+    writes.min_z=_mm_cvtss_f32(_mm_min_ss(lo, _mm_shuffle_ps(lo, lo, 1)));
+    writes.max_z=_mm_cvtss_f32(_mm_max_ss(hi, _mm_shuffle_ps(hi, hi, 1)));
+#endif
+    return result;
+}
+
+void Rasterizer::storeSamples(uint32_t* colors, uint32_t passed, uint32_t color)
+{
+#if defined(__AVX2__)
+    const __m256i bits=_mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i lanes=_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(passed), bits), bits);
+    _mm256_maskstore_epi32(reinterpret_cast<int*>(colors), lanes, _mm256_set1_epi32(color));
+#else
+    while(passed){
+        int s=std::countr_zero(passed);
+        passed&=passed-1;
+        colors[s]=color;
+    }
+#endif
+}
+
+void Rasterizer::clearSamples(int block)
+{
+    const int samples=getSamples();
+    int x0=(block%hiz_width)*Coverage::BLOCK_SIZE;
+    int y0=(block/hiz_width)*Coverage::BLOCK_SIZE;
+    int x1=std::min(x0+Coverage::BLOCK_SIZE, width);
+    int y1=std::min(y0+Coverage::BLOCK_SIZE, height);
+    for(int y=y0; y<y1; y++){
+        int begin=getIndex(x0, y)*samples, end=getIndex(x1, y)*samples;
+        std::fill(z_buffer.begin()+begin, z_buffer.begin()+end, std::numeric_limits<float>::max());
+        std::fill(sample_colors.begin()+begin, sample_colors.begin()+end, clear_color);
+    }
+    hiz_writes[block]=0;
+}
+
+void Rasterizer::resolvePixel(int index)
+{
+    // average in linear space, averaging the sRGB codes would darken edges
+    // edge pixels mostly hold a run or two of one color, each is decoded once
+    const int samples=getSamples();
+    const uint32_t* colors=&sample_colors[index*samples];
+    color_t sum=color_t::Zero();
+    color_t color=unpackSrgb(colors[0]);
+    for(int s=0; s<samples; s++){
+        if(s>0 && colors[s]!=colors[s-1])
+            color=unpackSrgb(colors[s]);
+        sum+=color;
+    }
+    color_target[index]=packSrgb(sum/static_cast<float>(samples));
+}
+
+void Rasterizer::resolve()
+{
+    const int samples=getSamples();
+    if(samples<=1)
+        return;
+
+    // blocks no triangle reached were never cleared and take the clear
+    // color; elsewhere most pixels hold one color in every sample, they are
+    // found a vector at a time and copied, only the others are averaged
+#pragma omp parallel for schedule(static)
+    for(int y=0; y<height; y++){
+        for(int bx=0; bx<width; bx+=Coverage::BLOCK_SIZE){
+            int block=(y/Coverage::BLOCK_SIZE)*hiz_width+bx/Coverage::BLOCK_SIZE;
+            int end=std::min(bx+Coverage::BLOCK_SIZE, width);
+            if(hiz_min[block]==std::numeric_limits<float>::max()){
+                std::fill(color_target+getIndex(bx, y), color_target+getIndex(end, y), clear_color);
+                continue;
+            }
+
+            int x=bx;
+#if defined(__AVX2__)
+            // compare every sample with the first sample of its pixel
+            const int step=8/samples;
+            const uint32_t group=(1u<<samples)-1;
+            const __m256i lanes=_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256i first=_mm256_andnot_si256(_mm256_set1_epi32(samples-1), lanes);
+            const __m256i pack=_mm256_mullo_epi32(lanes, _mm256_set1_epi32(samples));
+            for(; x+step<=end; x+=step){
+                int index=getIndex(x, y);
+                __m256i colors=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&sample_colors[index*samples]));
+                __m256i same=_mm256_cmpeq_epi32(colors, _mm256_permutevar8x32_epi32(colors, first));
+                uint32_t bits=_mm256_movemask_ps(_mm256_castsi256_ps(same));
+
+                if(bits==0xff){
+                    // gather the first sample of every pixel to the low lanes
+                    __m256i packed=_mm256_permutevar8x32_epi32(colors, pack);
+                    alignas(32) uint32_t out[8];
+                    _mm256_store_si256(reinterpret_cast<__m256i*>(out), packed);
+                    std::copy(out, out+step, color_target+index);
+                    continue;
+                }
+                for(int p=0; p<step; p++){
+                    if(((bits>>(p*samples))&group)==group)
+                        color_target[index+p]=sample_colors[(index+p)*samples];
+                    else
+                        resolvePixel(index+p);
+                }
+            }
+#endif
+            for(; x<end; x++){
+                int index=getIndex(x, y);
+                const uint32_t* colors=&sample_colors[index*samples];
+                if(std::all_of(colors+1, colors+samples, [&](uint32_t c){ return c==colors[0]; }))
+                    color_target[index]=colors[0];
+                else
+                    resolvePixel(index);
+            }
+        }
+    }
 }
 
 std::tuple<float, float, float> Rasterizer::computeBarycentric(int x, int y, const triangle_t& triangle)
@@ -93,43 +357,149 @@ std::tuple<float, float, float> Rasterizer::computeBarycentric(int x, int y, con
     }
 }
 
-void Rasterizer::drawTriangle(const triangle_t& triangle, ShaderInfo& shader_info)
+void Rasterizer::computeTexcoordDerivatives(const triangle_t& triangle, vec2f_t& duv_dx, vec2f_t& duv_dy)
+{
+    // texcoords are affine in screen space, so their derivatives are
+    // constant over the triangle and drive the texture lod
+    const auto& v=triangle.vertices;
+    const auto& t=triangle.texcoords;
+    vec2f_t e1(v[1].x()-v[0].x(), v[1].y()-v[0].y());
+    vec2f_t e2(v[2].x()-v[0].x(), v[2].y()-v[0].y());
+    float det=e1.x()*e2.y()-e2.x()*e1.y();
+    if(det!=0.f){
+        vec2f_t dt1=t[1]-t[0], dt2=t[2]-t[0];
+        duv_dx=(dt1*e2.y()-dt2*e1.y())/det;
+        duv_dy=(dt2*e1.x()-dt1*e2.x())/det;
+    }else{
+        duv_dx=vec2f_t::Zero();
+        duv_dy=vec2f_t::Zero();
+    }
+}
+
+bool Rasterizer::isOccluded(int min_x, int min_y, int max_x, int max_y, float z) const
+{
+    for(int by=min_y/Coverage::BLOCK_SIZE; by<=max_y/Coverage::BLOCK_SIZE; by++)
+        for(int bx=min_x/Coverage::BLOCK_SIZE; bx<=max_x/Coverage::BLOCK_SIZE; bx++)
+            if(z<=hiz_max[by*hiz_width+bx])
+                return false;
+    return true;
+}
+
+void Rasterizer::updateHiZ(int block)
+{
+    int x0=(block%hiz_width)*Coverage::BLOCK_SIZE;
+    int y0=(block/hiz_width)*Coverage::BLOCK_SIZE;
+    int x1=std::min(x0+Coverage::BLOCK_SIZE, width);
+    int y1=std::min(y0+Coverage::BLOCK_SIZE, height);
+
+    // over every sample, the samples of a row of the block are contiguous
+    const int samples=getSamples();
+    float min_z=std::numeric_limits<float>::max();
+    float max_z=std::numeric_limits<float>::lowest();
+#if defined(__AVX2__)
+    if(x1-x0==Coverage::BLOCK_SIZE){
+        __m256 lo=_mm256_set1_ps(min_z), hi=_mm256_set1_ps(max_z);
+        for(int y=y0; y<y1; y++){
+            const float* row=&z_buffer[getIndex(x0, y)*samples];
+            for(int i=0; i<Coverage::BLOCK_SIZE*samples; i+=8){
+                __m256 z=_mm256_loadu_ps(row+i);
+                lo=_mm256_min_ps(lo, z);
+                hi=_mm256_max_ps(hi, z);
+            }
+        }
+        __m128 lo4=_mm_min_ps(_mm256_castps256_ps128(lo), _mm256_extractf128_ps(lo, 1));
+        __m128 hi4=_mm_max_ps(_mm256_castps256_ps128(hi), _mm256_extractf128_ps(hi, 1));
+        lo4=_mm_min_ps(lo4, _mm_movehl_ps(lo4, lo4));
+        hi4=_mm_max_ps(hi4, _mm_movehl_ps(hi4, hi4));
+        hiz_min[block]=_mm_cvtss_f32(_mm_min_ss(lo4, _mm_shuffle_ps(lo4, lo4, 1)));
+        hiz_max[block]=_mm_cvtss_f32(_mm_max_ss(hi4, _mm_shuffle_ps(hi4, hi4, 1)));
+        return;
+    }
+#endif
+    for(int y=y0; y<y1; y++){
+        for(int i=getIndex(x0, y)*samples; i<getIndex(x1, y)*samples; i++){
+            min_z=std::min(min_z, z_buffer[i]);
+            max_z=std::max(max_z, z_buffer[i]);
+        }
+    }
+    hiz_min[block]=min_z;
+    hiz_max[block]=max_z;
+}
+
+uint32_t Rasterizer::addShaderInfo(const ShaderInfo& shader_info)
+{
+    bin_infos.push_back(shader_info);
+    return static_cast<uint32_t>(bin_infos.size()-1);
+}
+
+void Rasterizer::binTriangle(const triangle_t& triangle, uint32_t shader_info)
 {
-    if(isTriangleBackface(triangle))
+    Profiler::count(ProfileCounter::TRIANGLES_SUBMITTED);
+    if(isTriangleBackface(triangle)){
+        Profiler::count(ProfileCounter::TRIANGLES_CULLED);
         return;
+    }
 
     const auto& v=triangle.vertices;
-    const auto& n=triangle.normals;
-    const auto& t=triangle.texcoords;
-    const auto& c=triangle.colors;
-
-    float min_x=std::min({triangle.vertices[0].x(), triangle.vertices[1].x(), triangle.vertices[2].x()});
-    float max_x=std::max({triangle.vertices[0].x(), triangle.vertices[1].x(), triangle.vertices[2].x()});
-    float min_y=std::min({triangle.vertices[0].y(), triangle.vertices[1].y(), triangle.vertices[2].y()});
-    float max_y=std::max({triangle.vertices[0].y(), triangle.vertices[1].y(), triangle.vertices[2].y()});
-
-#pragma omp parallel for
-    for(int x=min_x; x<=max_x; x++){
-        for(int y=min_y; y<=max_y; y++){
-            // out of screen
-            if(x>width && y>height)
-                continue;
+    float min_x=std::min({v[0].x(), v[1].x(), v[2].x()});
+    float max_x=std::max({v[0].x(), v[1].x(), v[2].x()});
+    float min_y=std::min({v[0].y(), v[1].y(), v[2].y()});
+    float max_y=std::max({v[0].y(), v[1].y(), v[2].y()});
+
+    // out of screen, written so that NaN bounds are rejected as well
+    if(!(max_x>=0 && max_y>=0 && min_x<width && min_y<height)){
+        Profiler::count(ProfileCounter::TRIANGLES_CULLED);
+        return;
+    }
+    Profiler::count(ProfileCounter::TRIANGLES_RASTERIZED);
 
-            auto[alpha, beta, gamma]=computeBarycentric(x, y, triangle);
+    // clamp to the viewport before converting to tiles
+    int tx0=static_cast<int>(std::max(min_x, 0.f))/TILE_SIZE;
+    int tx1=static_cast<int>(std::min(max_x, width-1.f))/TILE_SIZE;
+    int ty0=static_cast<int>(std::max(min_y, 0.f))/TILE_SIZE;
+    int ty1=static_cast<int>(std::min(max_y, height-1.f))/TILE_SIZE;
 
-            // out of triangle
-            if(alpha>1 || alpha<0 || beta>1 || beta<0 || gamma>1 || gamma<0)
-                continue;
-            float z=1.f/(alpha/v[0].z()+beta/v[1].z()+gamma/v[2].z());
+    uint32_t index=static_cast<uint32_t>(bin_triangles.size());
+    bin_triangles.push_back(triangle);
+    bin_info_ids.push_back(shader_info);
 
-            shader_info.normal=interpolate<normal_t>(alpha, beta, gamma, n[0], n[1], n[2]);
-            shader_info.color=interpolate<color_t>(alpha, beta, gamma, c[0], c[1], c[2]);
-            shader_info.texcoord=interpolate<texcoord_t>(alpha, beta, gamma, t[0], t[1], t[2]);
+    for(int ty=ty0; ty<=ty1; ty++)
+        for(int tx=tx0; tx<=tx1; tx++)
+            tile_bins[ty*tiles_x+tx].push_back(index);
+}
 
-            if(setDepth(x, y, z))
-                setPixel(x, y, Shader::textureShader(shader_info));
-        }
+void Rasterizer::binLight(const light_t& light, const vec3f_t& screen_min, const vec3f_t& screen_max)
+{
+    Profiler::count(ProfileCounter::LIGHTS_SUBMITTED);
+    if(!(screen_max.x()>=0 && screen_max.y()>=0 && screen_min.x()<width && screen_min.y()<height))
+        return;
+
+    int tx0=static_cast<int>(std::max(screen_min.x(), 0.f))/TILE_SIZE;
+    int tx1=static_cast<int>(std::min(screen_max.x(), width-1.f))/TILE_SIZE;
+    int ty0=static_cast<int>(std::max(screen_min.y(), 0.f))/TILE_SIZE;
+    int ty1=static_cast<int>(std::min(screen_max.y(), height-1.f))/TILE_SIZE;
+
+    uint32_t index=static_cast<uint32_t>(bin_lights.size());
+    bin_lights.push_back(light);
+    bin_light_depths.emplace_back(screen_min.z(), screen_max.z());
+
+    for(int ty=ty0; ty<=ty1; ty++)
+        for(int tx=tx0; tx<=tx1; tx++)
+            tile_light_bins[ty*tiles_x+tx].push_back(index);
+}
+
+std::span<const light_t> Rasterizer::cullLights(int tile, float min_z, float max_z)
+{
+    auto& lights=tile_lights[tile];
+    lights.clear();
+    for(uint32_t index: tile_light_bins[tile]){
+        const vec2f_t& depth=bin_light_depths[index];
+        if(depth.x()<=max_z && depth.y()>=min_z)
+            lights.push_back(bin_lights[index]);
     }
+    tile_light_bins[tile].clear();
+    Profiler::count(ProfileCounter::TILE_LIGHTS, lights.size());
+    return lights;
 }
 
 void Rasterizer::drawLine(const line_t& line, const color_t& color)
@@ -207,5 +577,6 @@ bool Rasterizer::isTriangleBackface(const triangle_t& triangle)
     vec3f_t v1(v[2].x()-v[0].x(), v[2].y()-v[0].y(), v[2].z()-v[0].z());
     float dot=v0.cross(v1).z();
 
-    return dot<1e-2;
+    // screen space is y-down, so counter-clockwise front faces have negative area
+    return dot>-1e-2;
 }
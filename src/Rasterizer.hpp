@@ -1,16 +1,119 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
 #include <vector>
 
 #include "global.hpp"
-#include "Shader.hpp"
+#include "Color.hpp"
+#include "Coverage.hpp"
+#include "GBuffer.hpp"
+#include "Profiler.hpp"
+#include "ShaderProgram.hpp"
+
+// FORWARD shades every fragment that passes the depth test, DEFERRED
+// writes a G-buffer and shades every covered pixel once afterwards,
+// DEPTH_ONLY writes nothing but depth, e.g. for shadow maps
+enum class ShadingMode{
+    FORWARD,
+    DEFERRED,
+    DEPTH_ONLY
+};
 
 class Rasterizer{
+public:
+    static constexpr int TILE_SIZE=64;
+
 private:
+    // sort-middle binning: triangles are stored once per frame and every
+    // screen tile keeps the indices of the triangles overlapping it; shader
+    // inputs are stored once per draw batch and referenced by index
+    int                                tiles_x, tiles_y;
+    std::vector<triangle_t>            bin_triangles;
+    std::vector<uint32_t>              bin_info_ids;
+    std::vector<ShaderInfo>            bin_infos;
+    std::vector<std::vector<uint32_t>> tile_bins;
+
+    // lights are binned like triangles from their screen-space bounds;
+    // every tile culls its bin against the depth range it draws and shades
+    // with the survivors only
+    std::vector<light_t>               bin_lights;
+    std::vector<vec2f_t>               bin_light_depths;    // nearest and farthest screen z
+    std::vector<std::vector<uint32_t>> tile_light_bins;
+    std::vector<std::vector<light_t>>  tile_lights;
+
+    ShadingMode                        shading_mode=ShadingMode::FORWARD;
+    GBuffer                            gbuffer;
+
+    // multisampling keeps depth and color for every sample, the samples
+    // of one pixel are adjacent so that they are tested together; clear
+    // only resets the hierarchical z and 8x8 blocks are filled with
+    // clear_color when a triangle first reaches them
+    int                                sample_count=1;
+    std::vector<uint32_t>              sample_colors;
+    uint32_t                           clear_color=packSrgb({0.f, 0.f, 0.f});
+    // a multisampled block rescans its farthest depth only every
+    // HIZ_RESCAN writes, hiz_max stays conservative in between
+    static constexpr int               HIZ_RESCAN=4;
+    std::vector<uint8_t>               hiz_writes;
+
+    // DEFERRED writes triangle id and varyings to the G-buffer instead of
+    // shading, DEPTH_ONLY stops after the depth test
+    template<ShaderProgram P, ShadingMode MODE=ShadingMode::FORWARD>
+    int  drawTriangle(const triangle_t& triangle, const ShaderInfo& shader, int min_x, int min_y, int max_x, int max_y,
+        std::span<const light_t> lights, uint32_t id=0);
+    // coverage and depth per sample, shading once per pixel
+    template<ShaderProgram P>
+    int  drawTriangleSamples(const triangle_t& triangle, const ShaderInfo& shader, int min_x, int min_y, int max_x, int max_y,
+        std::span<const light_t> lights);
+    template<ShaderProgram P>
+    int  shadeGBuffer(int min_x, int min_y, int max_x, int max_y, std::span<const light_t> lights);
+    template<ShaderProgram P>
+    void interpolateVaryings(Fragment& fragment, const triangle_t& triangle, float alpha, float beta, float gamma);
+    template<ShaderProgram P>
+    static void reconstructPosition(Fragment& fragment, const ShaderInfo& shader);
+    // keeps the tile's binned lights that reach [min_z, max_z]
+    std::span<const light_t> cullLights(int tile, float min_z, float max_z);
+    void allocateSamples();
+    void clearSamples(int block);
+    // depth of a triangle's plane: z at pixel center (x, y), its steps per
+    // pixel and the offset of every sample from the pixel center
+    struct DepthPlane{
+        int   x, y;
+        float z, dz_dx, dz_dy;
+        float sample_dz[Coverage::MAX_SAMPLES];
+    };
+    // samples written by testSamples: a mask per pixel of the block, the
+    // samples passed in every given pixel and the range of depths stored
+    struct SampleWrites{
+        uint8_t  passed[Coverage::BLOCK_SIZE*Coverage::BLOCK_SIZE];
+        uint32_t common;
+        float    min_z, max_z;
+    };
+    // depth test of the covered samples of the given pixels of the 8x8 block
+    // at (bx, by), returns the pixels with any sample passed
+    uint64_t testSamples(int bx, int by, uint64_t pixels, uint64_t full, const uint8_t* coverage,
+        const DepthPlane& plane, bool visible, SampleWrites& writes);
+    // color to the samples of one pixel set in passed
+    static void storeSamples(uint32_t* colors, uint32_t passed, uint32_t color);
+    void resolvePixel(int index);
+    bool isOccluded(int min_x, int min_y, int max_x, int max_y, float z) const;
+    void updateHiZ(int block);
+
 public:
     int                   width, height;
-    std::vector<color_t>  frame_buffer;
+    // packed sRGB RGBA8 color, either color_buffer or an external target
+    uint32_t*             color_target=nullptr;
+    std::vector<uint32_t> color_buffer;
     std::vector<float>    z_buffer;
+    // hierarchical depth: nearest and farthest z of every 8x8 block of z_buffer
+    int                   hiz_width, hiz_height;
+    std::vector<float>    hiz_min;
+    std::vector<float>    hiz_max;
     matrix_t              model;
     matrix_t              view;
     matrix_t              projection;
@@ -24,19 +127,517 @@ public:
     void  resize(int width, int height);
     void  setPixel(int x, int y, const color_t &color);
     void  setPixel(const vertex_t& point, const color_t& color);
-    bool  setDepth(int x, int y, int z);
+    bool  setDepth(int x, int y, float z);
     int   getIndex(int x, int y) const;
     void* getFramebufferData();
 
+    void        setShadingMode(ShadingMode mode);
+    ShadingMode getShadingMode() const {return shading_mode;}
+
+    // 1, 2, 4 or 8 samples per pixel; the G-buffer holds one sample, so
+    // deferred shading always renders single-sampled, and so does depth only
+    void setSampleCount(int samples);
+    int  getSampleCount() const {return sample_count;}
+    int  getSamples() const     {return shading_mode==ShadingMode::FORWARD ? sample_count : 1;}
+    // averages the samples into the color target, drawBins does this itself
+    void resolve();
+
+    // render into external memory of width*height pixels, nullptr reverts
+    // to the rasterizer's own buffer
+    void      setColorTarget(uint32_t* target);
+    uint32_t* getColorTarget() const       {return color_target;}
+    uint32_t  getPixel(int x, int y) const {return color_target[getIndex(x, y)];}
+
     void drawPoint(const vertex_t& point, const color_t& color={0.f, 0.f, 0.f});
     void drawLine(const line_t& line, const color_t& color={0.f, 0.f, 0.f});
-    void drawTriangle(const triangle_t& triangle, ShaderInfo& shader);
+    uint32_t addShaderInfo(const ShaderInfo& shader);
+    void     binTriangle(const triangle_t& triangle, uint32_t shader);
+    // light reaching the screen-space box, x and y in pixels and z in depth
+    void     binLight(const light_t& light, const vec3f_t& screen_min, const vec3f_t& screen_max);
+
+    // shading is instantiated per program, see ShaderProgram.hpp; single
+    // triangles drawn multisampled become visible after resolve
+    template<ShaderProgram P=TextureProgram>
+    void drawTriangle(const triangle_t& triangle, const ShaderInfo& shader);
+    template<ShaderProgram P=TextureProgram>
+    void drawBins();
     
     static bool isInsideTriangle(int x, int y, const triangle_t& triangle);
     static bool isTriangleBackface(const triangle_t& triangle);
     static auto computeBarycentric(int x, int y, const triangle_t& triangle) -> std::tuple<float, float,float>;
+    static void computeTexcoordDerivatives(const triangle_t& triangle, vec2f_t& duv_dx, vec2f_t& duv_dy);
 
     template<typename T>
     auto interpolate(float alpha, float beta, float gamma, const T& v0, const T& v1, const T& v2) -> T
     { return alpha*v0+beta*v1+gamma*v2; }
 };
+
+template<ShaderProgram P>
+void Rasterizer::drawTriangle(const triangle_t& triangle, const ShaderInfo& shader_info)
+{
+    if(isTriangleBackface(triangle))
+        return;
+    if(shading_mode==ShadingMode::DEPTH_ONLY){
+        drawTriangle<P, ShadingMode::DEPTH_ONLY>(triangle, shader_info, 0, 0, width-1, height-1, {});
+        return;
+    }
+
+    // no tiles here, every binned light is passed on
+    int fragments=getSamples()>1
+        ? drawTriangleSamples<P>(triangle, shader_info, 0, 0, width-1, height-1, bin_lights)
+        : drawTriangle<P>(triangle, shader_info, 0, 0, width-1, height-1, bin_lights);
+    Profiler::count(ProfileCounter::FRAGMENTS_SHADED, fragments);
+}
+
+template<ShaderProgram P, ShadingMode MODE>
+int Rasterizer::drawTriangle(const triangle_t& triangle, const ShaderInfo& shader_info, int min_x, int min_y, int max_x, int max_y,
+    std::span<const light_t> lights, uint32_t id)
+{
+    const auto& v=triangle.vertices;
+    const auto& n=triangle.normals;
+    const auto& t=triangle.texcoords;
+    const auto& c=triangle.colors;
+    Fragment fragment;
+    fragment.lights=lights;
+
+    // the deferred lighting pass recomputes the derivatives per triangle
+    if constexpr(MODE==ShadingMode::FORWARD && (P::VARYINGS&Varying::TEXCOORD)!=0)
+        computeTexcoordDerivatives(triangle, fragment.texcoord_dx, fragment.texcoord_dy);
+
+    // attributes are only interpolated once the fragment passed the depth
+    // test, and only those the program declares
+    int fragments=0;
+    auto shade=[&](int x, int y, float z, float alpha, float beta, float gamma){
+        if constexpr(MODE==ShadingMode::DEPTH_ONLY)
+            return;
+        if constexpr(MODE==ShadingMode::DEFERRED){
+            // later fragments overwrite, only the visible one is lit
+            int index=getIndex(x, y);
+            gbuffer.triangles[index]=id;
+            if constexpr((P::VARYINGS&Varying::NORMAL)!=0)
+                gbuffer.normals[index]=packNormal(interpolate<normal_t>(alpha, beta, gamma, n[0], n[1], n[2]));
+            if constexpr((P::VARYINGS&Varying::TEXCOORD)!=0){
+                gbuffer.texcoord_u[index]=interpolate<float>(alpha, beta, gamma, t[0].x(), t[1].x(), t[2].x());
+                gbuffer.texcoord_v[index]=interpolate<float>(alpha, beta, gamma, t[0].y(), t[1].y(), t[2].y());
+            }
+            if constexpr((P::VARYINGS&Varying::COLOR)!=0)
+                gbuffer.albedo[index]=packSrgb(interpolate<color_t>(alpha, beta, gamma, c[0], c[1], c[2]));
+            return;
+        }
+
+        fragments++;
+        fragment.x=x;
+        fragment.y=y;
+        fragment.z=z;
+        interpolateVaryings<P>(fragment, triangle, alpha, beta, gamma);
+        reconstructPosition<P>(fragment, shader_info);
+
+        color_target[getIndex(x, y)]=packSrgb(P::shade(fragment, shader_info));
+    };
+
+    // fixed-point coverage only covers the guard band, larger triangles take
+    // the per-pixel barycentric path
+    if(!Coverage::inGuardBand(triangle)){
+        float fx0=std::min({v[0].x(), v[1].x(), v[2].x()}), fx1=std::max({v[0].x(), v[1].x(), v[2].x()});
+        float fy0=std::min({v[0].y(), v[1].y(), v[2].y()}), fy1=std::max({v[0].y(), v[1].y(), v[2].y()});
+        if(!(fx1>=min_x && fx0<=max_x && fy1>=min_y && fy0<=max_y))
+            return 0;
+
+        // clamp before converting, unclipped vertices may not fit an int
+        min_x=static_cast<int>(std::floor(std::max(fx0, static_cast<float>(min_x))));
+        max_x=static_cast<int>(std::ceil(std::min(fx1, static_cast<float>(max_x))));
+        min_y=static_cast<int>(std::floor(std::max(fy0, static_cast<float>(min_y))));
+        max_y=static_cast<int>(std::ceil(std::min(fy1, static_cast<float>(max_y))));
+
+        for(int y=min_y; y<=max_y; y++){
+            for(int x=min_x; x<=max_x; x++){
+                auto[alpha, beta, gamma]=computeBarycentric(x, y, triangle);
+
+                // out of triangle
+                if(alpha>1 || alpha<0 || beta>1 || beta<0 || gamma>1 || gamma<0)
+                    continue;
+                float z=interpolate<float>(alpha, beta, gamma, v[0].z(), v[1].z(), v[2].z());
+                if(setDepth(x, y, z))
+                    shade(x, y, z, alpha, beta, gamma);
+            }
+        }
+        return fragments;
+    }
+
+    Coverage coverage;
+    if(!coverage.setup(triangle, min_x, min_y, max_x, max_y))
+        return 0;
+
+    // whole triangle behind everything already drawn under its bounding box
+    float tri_min_z=std::min({v[0].z(), v[1].z(), v[2].z()});
+    float tri_max_z=std::max({v[0].z(), v[1].z(), v[2].z()});
+    if(isOccluded(coverage.getMinX(), coverage.getMinY(), coverage.getMaxX(), coverage.getMaxY(), tri_min_z))
+        return 0;
+
+    coverage.traverse([&](int bx, int by, uint64_t mask){
+        constexpr int last=Coverage::BLOCK_SIZE-1;
+        int block=(by/Coverage::BLOCK_SIZE)*hiz_width+bx/Coverage::BLOCK_SIZE;
+
+        // depth range of the triangle's plane over the block
+        float block_min_z=tri_max_z, block_max_z=tri_min_z;
+        for(auto[x, y]: {std::pair{bx, by}, {bx+last, by}, {bx, by+last}, {bx+last, by+last}}){
+            auto[alpha, beta, gamma]=coverage.barycentric(x, y);
+            float z=interpolate<float>(alpha, beta, gamma, v[0].z(), v[1].z(), v[2].z());
+            block_min_z=std::min(block_min_z, z);
+            block_max_z=std::max(block_max_z, z);
+        }
+        block_min_z=std::max(block_min_z, tri_min_z);
+        block_max_z=std::min(block_max_z, tri_max_z);
+
+        // block fully occluded
+        if(block_min_z>hiz_max[block])
+            return;
+        // block fully in front, no per-pixel test needed
+        bool visible=block_max_z<hiz_min[block];
+
+        bool written=false;
+        while(mask){
+            int bit=std::countr_zero(mask);
+            mask&=mask-1;
+
+            int x=bx+(bit&last);
+            int y=by+bit/Coverage::BLOCK_SIZE;
+            auto[alpha, beta, gamma]=coverage.barycentric(x, y);
+            float z=interpolate<float>(alpha, beta, gamma, v[0].z(), v[1].z(), v[2].z());
+
+            int index=getIndex(x, y);
+            if(!visible && z>z_buffer[index])
+                continue;
+            z_buffer[index]=z;
+            written=true;
+
+            shade(x, y, z, alpha, beta, gamma);
+        }
+
+        if(written)
+            updateHiZ(block);
+    });
+
+    return fragments;
+}
+
+template<ShaderProgram P>
+void Rasterizer::interpolateVaryings(Fragment& fragment, const triangle_t& triangle, float alpha, float beta, float gamma)
+{
+    const auto& n=triangle.normals;
+    const auto& t=triangle.texcoords;
+    const auto& c=triangle.colors;
+    if constexpr((P::VARYINGS&Varying::NORMAL)!=0)
+        fragment.normal=interpolate<normal_t>(alpha, beta, gamma, n[0], n[1], n[2]);
+    if constexpr((P::VARYINGS&Varying::TEXCOORD)!=0)
+        fragment.texcoord=interpolate<texcoord_t>(alpha, beta, gamma, t[0], t[1], t[2]);
+    if constexpr((P::VARYINGS&Varying::COLOR)!=0)
+        fragment.color=interpolate<color_t>(alpha, beta, gamma, c[0], c[1], c[2]);
+}
+
+template<ShaderProgram P>
+void Rasterizer::reconstructPosition(Fragment& fragment, const ShaderInfo& shader_info)
+{
+    // depth is linear in screen space, so the pixel center and its depth
+    // map back through the inverse projection exactly
+    if constexpr((P::VARYINGS&Varying::POSITION)!=0)
+        fragment.position=(shader_info.screen_to_world*vec4f_t(fragment.x+0.5f, fragment.y+0.5f, fragment.z, 1.f)).hnormalized();
+}
+
+template<ShaderProgram P>
+int Rasterizer::drawTriangleSamples(const triangle_t& triangle, const ShaderInfo& shader_info, int min_x, int min_y, int max_x, int max_y,
+    std::span<const light_t> lights)
+{
+    const auto& v=triangle.vertices;
+    const int samples=getSamples();
+    Fragment fragment;
+    fragment.lights=lights;
+
+    if constexpr((P::VARYINGS&Varying::TEXCOORD)!=0)
+        computeTexcoordDerivatives(triangle, fragment.texcoord_dx, fragment.texcoord_dy);
+    // the center of a partly covered pixel can lie off the triangle; its
+    // depth stays in the triangle's range, which the tile's lights cover
+    float tri_min_z=std::min({v[0].z(), v[1].z(), v[2].z()});
+    float tri_max_z=std::max({v[0].z(), v[1].z(), v[2].z()});
+
+    // attributes are interpolated at the pixel center and the color is
+    // stored to every sample that passed the depth test
+    int fragments=0;
+    auto shade=[&](int x, int y, float z, float alpha, float beta, float gamma, uint32_t passed){
+        fragments++;
+        fragment.x=x;
+        fragment.y=y;
+        fragment.z=std::clamp(z, tri_min_z, tri_max_z);
+        interpolateVaryings<P>(fragment, triangle, alpha, beta, gamma);
+        reconstructPosition<P>(fragment, shader_info);
+
+        storeSamples(&sample_colors[getIndex(x, y)*samples], passed, packSrgb(P::shade(fragment, shader_info)));
+    };
+
+    // triangles outside the guard band are only sampled at pixel centers
+    if(!Coverage::inGuardBand(triangle)){
+        float fx0=std::min({v[0].x(), v[1].x(), v[2].x()}), fx1=std::max({v[0].x(), v[1].x(), v[2].x()});
+        float fy0=std::min({v[0].y(), v[1].y(), v[2].y()}), fy1=std::max({v[0].y(), v[1].y(), v[2].y()});
+        if(!(fx1>=min_x && fx0<=max_x && fy1>=min_y && fy0<=max_y))
+            return 0;
+
+        min_x=static_cast<int>(std::floor(std::max(fx0, static_cast<float>(min_x))));
+        max_x=static_cast<int>(std::ceil(std::min(fx1, static_cast<float>(max_x))));
+        min_y=static_cast<int>(std::floor(std::max(fy0, static_cast<float>(min_y))));
+        max_y=static_cast<int>(std::ceil(std::min(fy1, static_cast<float>(max_y))));
+
+        for(int y=min_y; y<=max_y; y++){
+            for(int x=min_x; x<=max_x; x++){
+                auto[alpha, beta, gamma]=computeBarycentric(x, y, triangle);
+                if(alpha>1 || alpha<0 || beta>1 || beta<0 || gamma>1 || gamma<0)
+                    continue;
+                float z=interpolate<float>(alpha, beta, gamma, v[0].z(), v[1].z(), v[2].z());
+
+                int block=(y/Coverage::BLOCK_SIZE)*hiz_width+x/Coverage::BLOCK_SIZE;
+                if(hiz_min[block]==std::numeric_limits<float>::max())
+                    clearSamples(block);
+
+                // a single pixel with every sample at the center depth
+                DepthPlane flat{x, y, z, 0.f, 0.f, {}};
+                SampleWrites writes;
+                if(!testSamples(x, y, 1, 1, nullptr, flat, false, writes))
+                    continue;
+                // like setDepth, only the block minimum has to be exact
+                hiz_min[block]=std::min(hiz_min[block], z);
+                shade(x, y, z, alpha, beta, gamma, writes.passed[0]);
+            }
+        }
+        return fragments;
+    }
+
+    Coverage coverage;
+    if(!coverage.setup(triangle, min_x, min_y, max_x, max_y))
+        return 0;
+
+    if(isOccluded(coverage.getMinX(), coverage.getMinY(), coverage.getMaxX(), coverage.getMaxY(), tri_min_z))
+        return 0;
+
+    // depth is a plane in screen space, so every sample is the pixel
+    // center depth plus a constant step
+    auto depth=[&](int x, int y){
+        auto[alpha, beta, gamma]=coverage.barycentric(x, y);
+        return interpolate<float>(alpha, beta, gamma, v[0].z(), v[1].z(), v[2].z());
+    };
+    const SamplePattern& pattern=Coverage::samplePattern(samples);
+    DepthPlane plane{coverage.getMinX(), coverage.getMinY(), depth(coverage.getMinX(), coverage.getMinY()), 0.f, 0.f, {}};
+    plane.dz_dx=depth(plane.x+1, plane.y)-plane.z;
+    plane.dz_dy=depth(plane.x, plane.y+1)-plane.z;
+    for(int s=0; s<samples; s++)
+        plane.sample_dz[s]=(plane.dz_dx*pattern.x[s]+plane.dz_dy*pattern.y[s])/Coverage::SUBPIXEL_ONE;
+    float slack=(std::abs(plane.dz_dx)+std::abs(plane.dz_dy))*0.5f;
+
+    coverage.traverse(pattern, [&](int bx, int by, uint64_t pixels, uint64_t full, const uint8_t* masks){
+        constexpr int last=Coverage::BLOCK_SIZE-1;
+        int block=(by/Coverage::BLOCK_SIZE)*hiz_width+bx/Coverage::BLOCK_SIZE;
+
+        // depth range of the triangle's plane over the block's samples
+        float block_min_z=tri_max_z, block_max_z=tri_min_z;
+        for(auto[x, y]: {std::pair{bx, by}, {bx+last, by}, {bx, by+last}, {bx+last, by+last}}){
+            float z=depth(x, y);
+            block_min_z=std::min(block_min_z, z-slack);
+            block_max_z=std::max(block_max_z, z+slack);
+        }
+        block_min_z=std::max(block_min_z, tri_min_z);
+        block_max_z=std::min(block_max_z, tri_max_z);
+
+        if(block_min_z>hiz_max[block])
+            return;
+        bool visible=block_max_z<hiz_min[block];
+        if(hiz_min[block]==std::numeric_limits<float>::max())
+            clearSamples(block);
+
+        SampleWrites writes;
+        pixels=testSamples(bx, by, pixels, full, masks, plane, visible, writes);
+        if(!pixels)
+            return;
+
+        // depths only decrease, so the nearest one follows from the writes;
+        // the farthest is exact when every sample of the block was written
+        // and is rescanned every few writes otherwise
+        hiz_min[block]=std::min(hiz_min[block], writes.min_z);
+        bool whole=pixels==~0ull && writes.common==(1u<<samples)-1
+            && bx+Coverage::BLOCK_SIZE<=width && by+Coverage::BLOCK_SIZE<=height;
+        if(whole){
+            hiz_max[block]=writes.max_z;
+            hiz_writes[block]=0;
+        }else if(++hiz_writes[block]>=HIZ_RESCAN){
+            updateHiZ(block);
+            hiz_writes[block]=0;
+        }
+
+        while(pixels){
+            int bit=std::countr_zero(pixels);
+            pixels&=pixels-1;
+
+            int x=bx+(bit&last);
+            int y=by+bit/Coverage::BLOCK_SIZE;
+            auto[alpha, beta, gamma]=coverage.barycentric(x, y);
+            float z=interpolate<float>(alpha, beta, gamma, v[0].z(), v[1].z(), v[2].z());
+            shade(x, y, z, alpha, beta, gamma, writes.passed[bit]);
+        }
+    });
+
+    return fragments;
+}
+
+template<ShaderProgram P>
+int Rasterizer::shadeGBuffer(int min_x, int min_y, int max_x, int max_y, std::span<const light_t> lights)
+{
+    // neighbouring pixels mostly come from the same triangle, so its
+    // shader inputs and derivatives are only looked up when the id changes
+    int fragments=0;
+    uint32_t last=GBuffer::EMPTY;
+    const ShaderInfo* shader_info=nullptr;
+    Fragment fragment;
+    fragment.lights=lights;
+
+    // walk 8x8 blocks like the geometry pass did, blocks without any depth
+    // written are skipped through the hierarchical z
+    for(int by=min_y; by<=max_y; by+=Coverage::BLOCK_SIZE){
+        for(int bx=min_x; bx<=max_x; bx+=Coverage::BLOCK_SIZE){
+            int block=(by/Coverage::BLOCK_SIZE)*hiz_width+bx/Coverage::BLOCK_SIZE;
+            if(hiz_min[block]==std::numeric_limits<float>::max())
+                continue;
+
+            int x1=std::min(bx+Coverage::BLOCK_SIZE-1, max_x);
+            int y1=std::min(by+Coverage::BLOCK_SIZE-1, max_y);
+            for(int y=by; y<=y1; y++){
+                for(int x=bx; x<=x1; x++){
+                    int index=getIndex(x, y);
+                    uint32_t id=gbuffer.triangles[index];
+                    if(id==GBuffer::EMPTY)
+                        continue;
+                    if(id!=last){
+                        last=id;
+                        shader_info=&bin_infos[bin_info_ids[id]];
+                        if constexpr((P::VARYINGS&Varying::TEXCOORD)!=0)
+                            computeTexcoordDerivatives(bin_triangles[id], fragment.texcoord_dx, fragment.texcoord_dy);
+                    }
+
+                    fragment.x=x;
+                    fragment.y=y;
+                    fragment.z=z_buffer[index];
+                    if constexpr((P::VARYINGS&Varying::NORMAL)!=0)
+                        fragment.normal=unpackNormal(gbuffer.normals[index]);
+                    if constexpr((P::VARYINGS&Varying::TEXCOORD)!=0)
+                        fragment.texcoord=texcoord_t(gbuffer.texcoord_u[index], gbuffer.texcoord_v[index]);
+                    if constexpr((P::VARYINGS&Varying::COLOR)!=0)
+                        fragment.color=unpackSrgb(gbuffer.albedo[index]);
+                    reconstructPosition<P>(fragment, *shader_info);
+
+                    color_target[index]=packSrgb(P::shade(fragment, *shader_info));
+                    fragments++;
+                }
+            }
+        }
+    }
+    return fragments;
+}
+
+template<ShaderProgram P>
+void Rasterizer::drawBins()
+{
+    const bool deferred=shading_mode==ShadingMode::DEFERRED;
+    const bool depth_only=shading_mode==ShadingMode::DEPTH_ONLY;
+    const bool multisampled=getSamples()>1;
+    {
+        ProfileScope scope(ProfileStage::RASTERIZE);
+
+        // every worker owns whole tiles, so no two threads touch the same pixels
+#pragma omp parallel for schedule(dynamic, 1)
+        for(int tile=0; tile<tiles_x*tiles_y; tile++){
+            int min_x=(tile%tiles_x)*TILE_SIZE;
+            int min_y=(tile/tiles_x)*TILE_SIZE;
+            int max_x=std::min(min_x+TILE_SIZE, width)-1;
+            int max_y=std::min(min_y+TILE_SIZE, height)-1;
+
+            // forward shading has no depth yet, the tile's triangles bound it
+            std::span<const light_t> lights;
+            if(!deferred && !depth_only && !bin_lights.empty()){
+                float min_z=std::numeric_limits<float>::max(), max_z=std::numeric_limits<float>::lowest();
+                for(uint32_t index: tile_bins[tile]){
+                    for(const auto& vertex: bin_triangles[index].vertices){
+                        min_z=std::min(min_z, vertex.z());
+                        max_z=std::max(max_z, vertex.z());
+                    }
+                }
+                lights=cullLights(tile, min_z, max_z);
+            }
+
+            int fragments=0;
+            for(uint32_t index: tile_bins[tile]){
+                const ShaderInfo& shader_info=bin_infos[bin_info_ids[index]];
+                if(depth_only)
+                    drawTriangle<P, ShadingMode::DEPTH_ONLY>(bin_triangles[index], shader_info, min_x, min_y, max_x, max_y, {});
+                else if(deferred)
+                    drawTriangle<P, ShadingMode::DEFERRED>(bin_triangles[index], shader_info, min_x, min_y, max_x, max_y, {}, index);
+                else if(multisampled)
+                    fragments+=drawTriangleSamples<P>(bin_triangles[index], shader_info, min_x, min_y, max_x, max_y, lights);
+                else
+                    fragments+=drawTriangle<P>(bin_triangles[index], shader_info, min_x, min_y, max_x, max_y, lights);
+            }
+            tile_bins[tile].clear();
+            Profiler::count(ProfileCounter::FRAGMENTS_SHADED, fragments);
+        }
+    }
+
+    // the lighting pass reads the bins, so they are released after it
+    if(deferred){
+        ProfileScope scope(ProfileStage::LIGHTING);
+
+#pragma omp parallel for schedule(dynamic, 1)
+        for(int tile=0; tile<tiles_x*tiles_y; tile++){
+            int min_x=(tile%tiles_x)*TILE_SIZE;
+            int min_y=(tile/tiles_x)*TILE_SIZE;
+            int max_x=std::min(min_x+TILE_SIZE, width)-1;
+            int max_y=std::min(min_y+TILE_SIZE, height)-1;
+
+            // the geometry pass left the exact depth range of the tile behind;
+            // blocks without geometry are skipped through the hierarchical z
+            std::span<const light_t> lights;
+            if(!bin_lights.empty()){
+                float min_z=std::numeric_limits<float>::max(), max_z=std::numeric_limits<float>::lowest();
+                for(int by=min_y/Coverage::BLOCK_SIZE; by<=max_y/Coverage::BLOCK_SIZE; by++){
+                    for(int bx=min_x/Coverage::BLOCK_SIZE; bx<=max_x/Coverage::BLOCK_SIZE; bx++){
+                        int block=by*hiz_width+bx;
+                        if(hiz_min[block]==std::numeric_limits<float>::max())
+                            continue;
+                        min_z=std::min(min_z, hiz_min[block]);
+                        // a fully covered block has a finite farthest depth
+                        if(hiz_max[block]!=std::numeric_limits<float>::max()){
+                            max_z=std::max(max_z, hiz_max[block]);
+                            continue;
+                        }
+                        int x1=std::min((bx+1)*Coverage::BLOCK_SIZE, width);
+                        int y1=std::min((by+1)*Coverage::BLOCK_SIZE, height);
+                        for(int y=by*Coverage::BLOCK_SIZE; y<y1; y++)
+                            for(int x=bx*Coverage::BLOCK_SIZE; x<x1; x++)
+                                if(gbuffer.triangles[y*width+x]!=GBuffer::EMPTY)
+                                    max_z=std::max(max_z, z_buffer[y*width+x]);
+                    }
+                }
+                lights=cullLights(tile, min_z, max_z);
+            }
+            Profiler::count(ProfileCounter::FRAGMENTS_SHADED, shadeGBuffer<P>(min_x, min_y, max_x, max_y, lights));
+        }
+    }
+
+    if(multisampled){
+        ProfileScope scope(ProfileStage::RESOLVE);
+        resolve();
+    }
+
+    bin_triangles.clear();
+    bin_info_ids.clear();
+    bin_infos.clear();
+    bin_lights.clear();
+    bin_light_depths.clear();
+    // cullLights empties the bins it reads, depth-only draws never call it
+    for(auto& bin: tile_light_bins)
+        bin.clear();
+}
@@ -0,0 +1,79 @@
+#include "RenderContext.hpp"
+#include "Profiler.hpp"
+
+RenderContext::RenderContext(int width, int height)
+: camera_ptr(nullptr),
+  rasterizer(width, height),
+  depth_rasterizer(0, 0)
+{
+    depth_rasterizer.setShadingMode(ShadingMode::DEPTH_ONLY);
+    depth_shader.setProgram<DepthProgram>();
+}
+
+SceneObject& RenderContext::add(const Model& model, const matrix_t& model_mat)
+{
+    scene.push_back({&model, model_mat, {}});
+    return scene.back();
+}
+
+SceneObject& RenderContext::add(const Model& model, const std::vector<Instance>& instances)
+{
+    scene.push_back({&model, matrix_t::Identity(), instances});
+    return scene.back();
+}
+
+void RenderContext::clear(color_t color)
+{
+    ProfileScope scope(ProfileStage::CLEAR);
+    rasterizer.clear(color);
+}
+
+void RenderContext::render()
+{
+    if(camera_ptr)
+        shader.setViewPos(camera_ptr->getPosition());
+    shader.setTargetSize(rasterizer.width, rasterizer.height);
+    shader.binLights(rasterizer);
+
+    // every object is binned before any tile is drawn, the transformed
+    // buffers are reused from one object to the next
+    for(const SceneObject& object: scene){
+        shader.bind(object.model);
+        shader.setModel(object.model_mat);
+        shader.setInstances(object.instances);
+        shader.flush();
+        shader.transform();
+        shader.render(rasterizer);
+    }
+    shader.bind(nullptr);
+
+    // rasterize all binned triangles tile by tile
+    shader.drawBins(rasterizer);
+}
+
+void RenderContext::renderShadow(ShadowMap& shadow_map)
+{
+    if(depth_rasterizer.width!=shadow_map.size || depth_rasterizer.height!=shadow_map.size)
+        depth_rasterizer.resize(shadow_map.size, shadow_map.size);
+    depth_shader.setView(shadow_map.view_mat);
+    depth_shader.setProjection(shadow_map.projection_mat);
+    depth_shader.setTargetSize(shadow_map.size, shadow_map.size);
+    // levels of detail are picked for the map's texels
+    depth_shader.setLodError(shader.getLodError());
+
+    depth_rasterizer.clear();
+    for(const SceneObject& object: scene){
+        depth_shader.bind(object.model);
+        depth_shader.setModel(object.model_mat);
+        depth_shader.setInstances(object.instances);
+        depth_shader.flush();
+        depth_shader.transform();
+        depth_shader.render(depth_rasterizer);
+    }
+    depth_shader.bind(nullptr);
+    depth_shader.drawBins(depth_rasterizer);
+
+    // the map takes the depth over and hands its old buffer of the same
+    // size back, the next clear overwrites it
+    shadow_map.depth.swap(depth_rasterizer.z_buffer);
+}
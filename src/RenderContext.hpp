@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include "Camera.hpp"
+#include "Model.hpp"
+#include "Rasterizer.hpp"
+#include "Shader.hpp"
+#include "ShadowMap.hpp"
+
+// one model placed in a scene; the model is only read while rendering, so
+// any number of contexts can draw it at the same time
+struct SceneObject{
+    const Model*          model=nullptr;
+    matrix_t              model_mat=matrix_t::Identity();
+    std::vector<Instance> instances;    // one copy per instance, none draws model_mat
+};
+
+// Everything one view renders with: its bindings, the objects of its scene
+// and the scratch memory of every stage, from the transformed vertices to
+// the tile bins and the depth pass of shadow maps. Contexts share no render
+// state, so several of them can render on different threads at once, e.g.
+// one camera each over the same models. Each thread counts into its own
+// Profiler block, the frame's counters add up over all contexts.
+class RenderContext{
+private:
+    Camera*                  camera_ptr;
+    Rasterizer               rasterizer;
+    Shader                   shader;
+    std::vector<SceneObject> scene;
+
+    // depth-only pass for shadow maps, sized to the last map rendered
+    Rasterizer               depth_rasterizer;
+    Shader                   depth_shader;
+
+public:
+    RenderContext(int width, int height);
+    RenderContext(const RenderContext&)=delete;
+    RenderContext& operator=(const RenderContext&)=delete;
+
+    // the camera's position is the view position of every frame, view and
+    // projection stay on the shader
+    void bind(Camera* camera_ptr) {this->camera_ptr=camera_ptr;}
+    Rasterizer& getRasterizer()         {return rasterizer;}
+    Shader&     getShader()             {return shader;}
+
+    // objects are drawn in the order they were added, the returned
+    // reference stays valid until the next add
+    SceneObject& add(const Model& model, const matrix_t& model_mat=matrix_t::Identity());
+    SceneObject& add(const Model& model, const std::vector<Instance>& instances);
+    std::vector<SceneObject>&       getScene()       {return scene;}
+    const std::vector<SceneObject>& getScene() const {return scene;}
+    void clearScene() {scene.clear();}
+
+    void clear(color_t color=color_t{0.f, 0.f, 0.f});
+    void render();
+    // depth of the scene from the shadow map's light; call before render
+    // for the frame
+    void renderShadow(ShadowMap& shadow_map);
+};
@@ -1,12 +1,25 @@
 #include "Shader.hpp"
-#include "Pipeline.hpp"
+#include "Clipper.hpp"
+#include "Profiler.hpp"
+
+#include <optional>
 
 Shader::Shader()
-: view_pos(direct_t::Zero()),
+: model_ptr(nullptr),
+  view_pos(direct_t::Zero()),
   model_mat(matrix_t::Identity()),
   view_mat(matrix_t::Identity()),
-  projection_mat(matrix_t::Identity())
+  projection_mat(matrix_t::Identity()),
+  target_width(SCR_WIDTH),
+  target_height(SCR_HEIGHT),
+  lod_error(1.f)
 {
+    setProgram<TextureProgram>();
+}
+
+void Shader::bind(const Model* model)
+{
+    model_ptr=model;
 }
 
 void Shader::setViewPos(const direct_t& view_pos)
@@ -19,6 +32,11 @@ void Shader::setModel(const matrix_t& model_mat)
     this->model_mat=model_mat;
 }
 
+void Shader::setInstances(const std::vector<Instance>& instances)
+{
+    this->instances=instances;
+}
+
 void Shader::setView(const matrix_t& view_mat)
 {
     this->view_mat=view_mat;
@@ -29,180 +47,440 @@ void Shader::setProjection(const matrix_t& projection_mat)
     this->projection_mat=projection_mat;
 }
 
-void Shader::use()
+void Shader::setTargetSize(int width, int height)
+{
+    target_width=static_cast<float>(width);
+    target_height=static_cast<float>(height);
+}
+
+void Shader::setLights(const std::vector<light_t>& lights)
 {
-    Pipeline::bind(this);
+    this->lights=lights;
 }
 
 void Shader::flush()
 {
-    current_model=origin_model;
+    ProfileScope scope(ProfileStage::FLUSH);
+    if(!model_ptr)
+        return;
+
+    // the per-copy buffers are sized in transform, once culling has
+    // decided how many instances are visible
+    size_t copies=std::max<size_t>(instances.size(), 1);
+    visible_instances.reserve(copies);
+    transforms.reserve(copies);
+}
+
+std::span<const Instance> Shader::getDraws(const Instance& single) const
+{
+    return instances.empty() ? std::span<const Instance>(&single, 1) : std::span<const Instance>(instances);
+}
+
+// object space tests of a whole meshlet for one instance, both only reject
+// what the per-triangle tests would reject anyway
+struct MeshletCulling{
+    vec4f_t planes[6];  // the planes of Clipper::outcode, inside is positive
+    vec3f_t eye;        // a point, or the direction towards it when eye_w is 0
+    float   eye_w;
+    float   facing;     // sign of a front face's normal dotted with the eye ray, 0 to never cull
+
+    MeshletCulling(const matrix_t& mvp_mat, float width, float height);
+    bool isOutside(const Meshlet& meshlet) const;
+    bool isBackface(const Meshlet& meshlet) const;
+};
+
+MeshletCulling::MeshletCulling(const matrix_t& mvp_mat, float width, float height)
+{
+    vec4f_t x=mvp_mat.row(0).transpose();
+    vec4f_t y=mvp_mat.row(1).transpose();
+    vec4f_t z=mvp_mat.row(2).transpose();
+    vec4f_t w=mvp_mat.row(3).transpose();
+    vec4f_t clip_planes[6]={x, width*w-x, y, height*w-y, z, w-z};
+    for(int p=0; p<6; p++){
+        float length=clip_planes[p].head<3>().norm();
+        planes[p]=length>0.f ? vec4f_t(clip_planes[p]/length) : clip_planes[p];
+    }
+
+    // the eye is what the projection maps to x=y=w=0, the null space of
+    // those rows; a face is front facing on screen when the eye is on one
+    // side of its plane, which side is read off a reference face
+    Eigen::Matrix<double, 3, 4> rows;
+    rows.row(0)=mvp_mat.row(0).cast<double>();
+    rows.row(1)=mvp_mat.row(1).cast<double>();
+    rows.row(2)=mvp_mat.row(3).cast<double>();
+    Eigen::Vector4d null;
+    for(int j=0; j<4; j++){
+        Eigen::Matrix3d minor;
+        for(int c=0, k=0; c<4; c++)
+            if(c!=j)
+                minor.col(k++)=rows.col(c);
+        null[j]=(j&1 ? -1.0 : 1.0)*minor.determinant();
+    }
+    Eigen::Vector3d point=null.head<3>();
+    double point_w=0.0;
+    if(std::abs(null[3])>1e-6*point.norm()){
+        point/=null[3];
+        point_w=1.0;
+    }else{
+        point.normalize();
+    }
+    eye=point.cast<float>();
+    eye_w=static_cast<float>(point_w);
+
+    int k;
+    point.cwiseAbs().maxCoeff(&k);
+    Eigen::Vector3d a=point_w*(point+Eigen::Vector3d::Unit(k));
+    Eigen::Vector3d corners[3]={a, a+Eigen::Vector3d::Unit((k+1)%3), a+Eigen::Vector3d::Unit((k+2)%3)};
+    Eigen::Matrix3d projected;
+    for(int v=0; v<3; v++)
+        projected.col(v)=rows*corners[v].homogeneous();
+    double side=point_w*a[k]-point[k];
+    double area=projected.determinant();
+    // counter-clockwise front faces have negative area, as in the rasterizer
+    facing=area==0.0 || side==0.0 || !std::isfinite(area) ? 0.f : (area<0.0)==(side>0.0) ? 1.f : -1.f;
+}
+
+bool MeshletCulling::isOutside(const Meshlet& meshlet) const
+{
+    for(const vec4f_t& plane: planes)
+        if(plane.head<3>().dot(meshlet.center)+plane.w()<-meshlet.radius)
+            return true;
+    return false;
+}
+
+bool MeshletCulling::isBackface(const Meshlet& meshlet) const
+{
+    if(facing==0.f || meshlet.cone_cutoff>=1.f)
+        return false;
+    // back facing if every normal in the cone points away from every eye
+    // ray into the sphere, with a little slack for rounding
+    vec3f_t away=facing*(eye-eye_w*meshlet.center);
+    float distance=away.norm();
+    float spread=eye_w*meshlet.radius;
+    return away.dot(meshlet.cone_axis)>meshlet.cone_cutoff*(distance+spread)+spread+1e-4f*distance;
+}
+
+uint32_t Shader::selectLod(const Mesh& mesh, const DrawRange& range, const matrix_t& mvp_mat) const
+{
+    if(lod_error<=0.f || range.lod_count<2)
+        return 0;
+
+    // pixels per object unit from the screen-space derivative at the
+    // center of the range's bounding sphere, taken at its nearest depth
+    vec3f_t center=(range.bounds_min+range.bounds_max)/2.f;
+    float radius=(range.bounds_max-range.bounds_min).norm()/2.f;
+    vec4f_t clip=mvp_mat*center.homogeneous();
+    float w=clip.w()-radius*mvp_mat.block<1, 3>(3, 0).norm();
+    if(w<=0.f)
+        return 0;
+    vec2f_t screen=clip.head<2>()/clip.w();
+    float scale=(mvp_mat.block<1, 3>(0, 0)-screen.x()*mvp_mat.block<1, 3>(3, 0)).norm()
+               +(mvp_mat.block<1, 3>(1, 0)-screen.y()*mvp_mat.block<1, 3>(3, 0)).norm();
+    scale/=w;
+
+    uint32_t level=0;
+    while(level+1<range.lod_count && mesh.lods[range.lod_offset+level+1].error*scale<=lod_error)
+        level++;
+    return level;
 }
 
 void Shader::transform()
 {
-    auto&& mvp_mat=projection_mat*view_mat*model_mat;
-    if(mvp_mat==matrix_t::Identity())
+    ProfileScope scope(ProfileStage::TRANSFORM);
+    if(!model_ptr)
         return;
 
-    auto& vertices=current_model.attrib.vertices;
-    auto& normals=current_model.attrib.normals;
-
-#pragma omp parallel for
-    for(size_t i=0; i<vertices.size(); i+=3){
-        // transform vertices
-        auto vec_v=vec4f_t(vertices[i], vertices[i+1], vertices[i+2], 1.f);
-        vec_v=mvp_mat*vec_v;
-        vec_v/=vec_v[3];
-        vertices[i]=vec_v[0];
-        vertices[i+1]=vec_v[1];
-        vertices[i+2]=vec_v[2];
-
-        // transform normals
-        auto vec_n=vec4f_t(normals[i], normals[i+1], normals[i+2], 1.f);
-        vec_n=model_mat.inverse().transpose()*vec_n;
-        vec_n/=vec_n[3];
-        normals[i]=vec_n[0];
-        normals[i+1]=vec_n[1];
-        normals[i+2]=vec_n[2];
+    const Mesh& mesh=model_ptr->mesh;
+    const float* src_positions=mesh.positions.data();
+    const float* src_normals=mesh.normals.data();
+    const long vertex_count=static_cast<long>(mesh.getVertexCount());
+    const size_t range_count=mesh.ranges.size();
+    const bool transform_normals=(varyings&Varying::NORMAL)!=0;
+    const Instance single{model_mat};
+    std::span<const Instance> draws=getDraws(single);
+    matrix_t vp_mat=projection_mat*view_mat;
+
+    vec3f_t bounds_min=vec3f_t::Constant(std::numeric_limits<float>::max());
+    vec3f_t bounds_max=vec3f_t::Constant(std::numeric_limits<float>::lowest());
+    for(const DrawRange& range: mesh.ranges){
+        bounds_min=bounds_min.cwiseMin(range.bounds_min);
+        bounds_max=bounds_max.cwiseMax(range.bounds_max);
+    }
+
+    // instances entirely outside the frustum are dropped before anything
+    // is transformed, the others get the next slot of the buffers
+    transforms.clear();
+    visible_instances.clear();
+    for(uint32_t n=0; n<draws.size(); n++){
+        matrix_t mvp_mat=vp_mat*draws[n].model_mat;
+        if(range_count==0 || Clipper::isBoxOutside(bounds_min, bounds_max, mvp_mat, target_width, target_height)){
+            Profiler::count(ProfileCounter::INSTANCES_CULLED);
+            continue;
+        }
+        visible_instances.push_back(n);
+        transforms.push_back({mvp_mat, draws[n].model_mat.topLeftCorner<3, 3>().inverse().transpose()});
     }
-}
 
-void Shader::render()
-{
-    const auto& attrib=current_model.attrib;
-    const auto& shapes=current_model.shapes;
-    const auto& materials=current_model.materials;
-    const auto& textures=current_model.textures;
-
-// #pragma omp parallel for
-    // loop over shapes
-    for(size_t s=0; s<shapes.size(); s++){
-        size_t index_offset=0;
-
-        // loop over faces
-        for(size_t f=0; f<shapes[s].mesh.num_face_vertices.size(); f++) {
-            size_t fv=static_cast<size_t>(shapes[s].mesh.num_face_vertices[f]);
-            triangle_t triangle;
-
-            // read materials7
-            ShaderInfo shader_info;
-            int id=shapes[s].mesh.material_ids[f];
-            if(id>=0){
-                shader_info.ambient=vec3f_t(materials[id].ambient[0], materials[id].ambient[1], materials[id].ambient[2]);
-                shader_info.diffuse=vec3f_t(materials[id].diffuse[0], materials[id].diffuse[1], materials[id].diffuse[2]);
-                shader_info.specular=vec3f_t(materials[id].specular[0], materials[id].specular[1], materials[id].specular[2]);
-
-                if(!materials[id].diffuse_texname.empty())
-                    shader_info.textures.push_back(textures.at(materials[id].diffuse_texname));
-                if(!materials[id].specular_texname.empty())
-                    shader_info.textures.push_back(textures.at(materials[id].specular_texname));
-                if(!materials[id].bump_texname.empty())
-                    shader_info.textures.push_back(textures.at(materials[id].bump_texname));
-
-            }else if(!current_model.textures.empty()){
-                for(auto& texture: current_model.textures)
-                    shader_info.textures.push_back(texture.second);
+    // one copy of the mesh per visible instance, no reallocation once the
+    // buffers fit the most instances seen in view
+    const size_t copies=visible_instances.size();
+    clip_positions.resize(copies*vertex_count*4);
+    positions.resize(copies*mesh.positions.size());
+    normals.resize(copies*mesh.normals.size());
+    clip_codes.resize(copies*vertex_count);
+    visible_ranges.resize(copies*range_count);
+    range_lods.resize(copies*range_count);
+    visible_meshlets.resize(copies*mesh.meshlets.size());
+    used_vertices.resize(copies*vertex_count);
+
+    // shapes entirely outside the frustum are skipped from here on;
+    // neighbouring visible shapes of an instance become one span of work,
+    // cut into chunks so that one large instance still spreads over threads;
+    // levels with fewer vertices than CULL_VERTICES skip the meshlet tests,
+    // they cost more than transforming the whole level
+    constexpr long CHUNK=4096;
+    constexpr uint32_t CULL_VERTICES=1024;
+    spans.clear();
+    for(uint32_t slot=0; slot<visible_instances.size(); slot++){
+        uint8_t* visible=visible_ranges.data()+slot*range_count;
+        uint8_t* lods=range_lods.data()+slot*range_count;
+        uint8_t* meshlets=visible_meshlets.data()+slot*mesh.meshlets.size();
+        uint8_t* used=used_vertices.data()+static_cast<size_t>(slot)*vertex_count;
+        std::optional<MeshletCulling> culling;
+        if(vertex_count>=CULL_VERTICES)
+            culling.emplace(transforms[slot].mvp_mat, target_width, target_height);
+        for(size_t r=0; r<range_count; r++){
+            const DrawRange& range=mesh.ranges[r];
+            bool outside=range_count>1 && Clipper::isBoxOutside(range.bounds_min, range.bounds_max, transforms[slot].mvp_mat, target_width, target_height);
+            visible[r]=!outside;
+            lods[r]=outside ? 0 : selectLod(mesh, range, transforms[slot].mvp_mat);
+            if(outside){
+                Profiler::count(ProfileCounter::SHAPES_CULLED);
+                continue;
             }
 
-            // loop over vertices
-            for(size_t v=0; v<fv; v++){
-                auto idx=shapes[s].mesh.indices[index_offset+v];
-
-                // record vertices
-                triangle.vertices[v]=vertex_t{
-                    attrib.vertices[3*size_t(idx.vertex_index)+0],
-                    attrib.vertices[3*size_t(idx.vertex_index)+1],
-                    attrib.vertices[3*size_t(idx.vertex_index)+2]
-                };
-
-                // record normals
-                if(idx.normal_index >= 0){
-                    triangle.normals[v]=normal_t(
-                        attrib.normals[3*size_t(idx.normal_index)+0],
-                        attrib.normals[3*size_t(idx.normal_index)+1],
-                        attrib.normals[3*size_t(idx.normal_index)+2]
-                    ).normalized();
+            // meshlets off screen or facing away are dropped next, only
+            // the vertices of the others get transformed
+            const DrawLod& lod=mesh.lods[range.lod_offset+lods[r]];
+            bool cull=lod.vertex_count>=CULL_VERTICES;
+            if(cull)
+                std::fill_n(used+range.vertex_offset, lod.vertex_count, 0);
+            for(uint32_t b=lod.batch_offset; b<lod.batch_offset+lod.batch_count; b++){
+                const DrawBatch& batch=mesh.batches[b];
+                if(!cull){
+                    std::fill_n(meshlets+batch.meshlet_offset, batch.meshlet_count, 1);
+                    continue;
                 }
-
-                // record textures
-                if(idx.texcoord_index >= 0){
-                    triangle.texcoords[v]=texcoord_t(
-                        attrib.texcoords[2*size_t(idx.texcoord_index)+0],
-                        attrib.texcoords[2*size_t(idx.texcoord_index)+1]
-                    );
+                for(uint32_t m=batch.meshlet_offset; m<batch.meshlet_offset+batch.meshlet_count; m++){
+                    const Meshlet& meshlet=mesh.meshlets[m];
+                    meshlets[m]=!culling->isOutside(meshlet) && !culling->isBackface(meshlet);
+                    if(!meshlets[m]){
+                        Profiler::count(ProfileCounter::MESHLETS_CULLED);
+                        continue;
+                    }
+                    for(uint32_t v=meshlet.vertex_offset; v<meshlet.vertex_offset+meshlet.vertex_count; v++)
+                        used[mesh.meshlet_vertices[v]]=1;
                 }
+            }
+        }
+        // coarser levels only use a prefix of the range's vertices, spans
+        // don't mix levels that were culled by meshlet with ones that weren't
+        auto vertexCount=[&](size_t r){ return mesh.lods[mesh.ranges[r].lod_offset+lods[r]].vertex_count; };
+        for(size_t r=0; r<range_count;){
+            if(!visible[r]){
+                r++;
+                continue;
+            }
+            bool culled=vertexCount(r)>=CULL_VERTICES;
+            long begin=mesh.ranges[r].vertex_offset;
+            long end=begin+vertexCount(r);
+            for(r++; r<range_count && visible[r] && mesh.ranges[r].vertex_offset==end && (vertexCount(r)>=CULL_VERTICES)==culled; r++)
+                end+=vertexCount(r);
+            for(long b=begin; b<end; b+=CHUNK)
+                spans.push_back({slot, b, std::min(b+CHUNK, end), culled});
+        }
+    }
 
-                // record colors
-                triangle.colors[v]=color_t(
-                    attrib.colors[3*size_t(idx.vertex_index)+0],
-                    attrib.colors[3*size_t(idx.vertex_index)+1],
-                    attrib.colors[3*size_t(idx.vertex_index)+2]
-                );
+    // positions and normals are parallel streams
+#pragma omp parallel for schedule(dynamic, 1)
+    for(size_t s=0; s<spans.size(); s++){
+        const Span& span=spans[s];
+        const matrix_t& mvp_mat=transforms[span.slot].mvp_mat;
+        const mat3f_t& normal_mat=transforms[span.slot].normal_mat;
+        const long base=static_cast<long>(span.slot)*vertex_count;
+        for(long i=span.begin; i<span.end; i++){
+            long o=base+i;
+            if(span.culled && !used_vertices[o])
+                continue;
+            vec4f_t v=mvp_mat*vec4f_t(src_positions[3*i], src_positions[3*i+1], src_positions[3*i+2], 1.f);
+            for(int k=0; k<4; k++)
+                clip_positions[4*o+k]=v[k];
+
+            // only vertices inside the clip planes can be divided right away
+            uint32_t code=Clipper::outcode(v, target_width, target_height);
+            clip_codes[o]=code;
+            if(!(code&Clipper::CLIP_PLANES)){
+                positions[3*o]=v[0]/v[3];
+                positions[3*o+1]=v[1]/v[3];
+                positions[3*o+2]=v[2]/v[3];
             }
-            index_offset+=fv;
 
-            shader_info.view_pos=view_pos;
-            Pipeline::rasterizer_ptr->drawTriangle(triangle, shader_info);
+            if(transform_normals){
+                vec3f_t n=(normal_mat*vec3f_t(src_normals[3*i], src_normals[3*i+1], src_normals[3*i+2])).normalized();
+                normals[3*o]=n[0];
+                normals[3*o+1]=n[1];
+                normals[3*o+2]=n[2];
+            }
         }
     }
 }
 
-color_t Shader::phongShader(const ShaderInfo& shader)
+void Shader::render(Rasterizer& rasterizer)
 {
-    light_t light({20, 20, 20}, {500, 500, 500});
-
-    vec3f_t amb_light_intensity{10, 10, 10};
-    vec3f_t eye_pos{0, 0, 10};
-
-    const vec3f_t& ka=shader.ambient;
-    const vec3f_t& kd=shader.color;
-    const vec3f_t& ks=shader.specular;
-    const vec3f_t& point=shader.view_pos;
-    const vec3f_t& normal=shader.normal;
-
-    vec3f_t l=(light.position-point).normalized();
-    vec3f_t v=(eye_pos-point).normalized();
-    vec3f_t h=(l+v).normalized();
-    vec3f_t i=light.intensity/(light.position-point).dot(light.position-point);
+    ProfileScope scope(ProfileStage::RENDER);
+    if(!model_ptr)
+        return;
 
-    vec3f_t ambient=ka.cwiseProduct(amb_light_intensity);
-    vec3f_t diffuse=kd.cwiseProduct(i)*std::max(0.0f, normal.dot(l));
-    vec3f_t specular=ks.cwiseProduct(i)*pow(std::max(0.0f, normal.dot(h)), 128);
-    vec3f_t result_color=ambient+diffuse+specular;
+    const Mesh& mesh=model_ptr->mesh;
+    matrix_t screen_to_world=(projection_mat*view_mat).inverse();
+    const Instance single{model_mat};
+    std::span<const Instance> draws=getDraws(single);
+    const size_t vertex_count=mesh.getVertexCount();
+
+    // loop over instances and their shapes that survived frustum culling
+    for(uint32_t slot=0; slot<visible_instances.size(); slot++){
+        const Instance& instance=draws[visible_instances[slot]];
+        for(size_t r=0; r<mesh.ranges.size(); r++){
+            if(!visible_ranges[slot*mesh.ranges.size()+r])
+                continue;
+            const DrawRange& range=mesh.ranges[r];
+            const DrawLod& lod=mesh.lods[range.lod_offset+range_lods[slot*mesh.ranges.size()+r]];
+
+            // one set of shader inputs per material batch with a meshlet
+            // left after culling
+            const uint8_t* meshlets=visible_meshlets.data()+slot*mesh.meshlets.size();
+            for(uint32_t b=lod.batch_offset; b<lod.batch_offset+lod.batch_count; b++){
+                const DrawBatch& batch=mesh.batches[b];
+                if(std::none_of(meshlets+batch.meshlet_offset, meshlets+batch.meshlet_offset+batch.meshlet_count, [](uint8_t v){ return v; }))
+                    continue;
+                const Material& material=model_ptr->getMaterial(batch.material_id);
+
+                ShaderInfo shader_info;
+                shader_info.view_pos=view_pos;
+                shader_info.screen_to_world=screen_to_world;
+                shader_info.lit=!lights.empty();
+                shader_info.tint=instance.tint;
+                shader_info.ambient=material.ambient;
+                shader_info.diffuse=material.diffuse;
+                shader_info.specular=material.specular;
+                shader_info.diffuse_texture=material.diffuse_texture.get();
+                shader_info.specular_texture=material.specular_texture.get();
+                shader_info.bump_texture=material.bump_texture.get();
+                uint32_t info=rasterizer.addShaderInfo(shader_info);
+
+                for(uint32_t m=batch.meshlet_offset; m<batch.meshlet_offset+batch.meshlet_count; m++){
+                    if(!meshlets[m])
+                        continue;
+                    const Meshlet& meshlet=mesh.meshlets[m];
+                    for(uint32_t i=meshlet.index_offset; i<meshlet.index_offset+meshlet.index_count; i+=3)
+                        assemble(rasterizer, mesh, i, slot*vertex_count, info);
+                }
+            }
+        }
+    }
+}
 
-    return result_color;
+void Shader::binLights(Rasterizer& rasterizer)
+{
+    ProfileScope scope(ProfileStage::RENDER);
+    matrix_t vp_mat=projection_mat*view_mat;
+    const float inf=std::numeric_limits<float>::infinity();
+
+    for(const light_t& light: lights){
+        // the projected corners of the box around the light's sphere bound
+        // it on screen, unless a corner is behind the eye
+        vec3f_t screen_min(-inf, -inf, -inf), screen_max(inf, inf, inf);
+        if(std::isfinite(light.radius)){
+            vec3f_t corner_min(inf, inf, inf), corner_max(-inf, -inf, -inf);
+            bool behind=false;
+            for(int c=0; c<8; c++){
+                vec3f_t offset((c&1) ? light.radius : -light.radius,
+                               (c&2) ? light.radius : -light.radius,
+                               (c&4) ? light.radius : -light.radius);
+                vec4f_t clip=vp_mat*(light.position+offset).homogeneous();
+                if(clip.w()<=0.f){
+                    behind=true;
+                    break;
+                }
+                vec3f_t screen=clip.hnormalized();
+                corner_min=corner_min.cwiseMin(screen);
+                corner_max=corner_max.cwiseMax(screen);
+            }
+            if(!behind){
+                screen_min=corner_min;
+                screen_max=corner_max;
+            }
+        }
+        rasterizer.binLight(light, screen_min, screen_max);
+    }
 }
 
-color_t Shader::textureShader(const ShaderInfo& shader)
+void Shader::assemble(Rasterizer& rasterizer, const Mesh& mesh, uint32_t i, size_t base, uint32_t info)
 {
-    vec3f_t texture_color=vec3f_t::Identity();
-    if(!shader.textures.empty()){
-        texture_color=shader.textures[0]->sample(shader.texcoord.x(), shader.texcoord.y());
-        for(auto& texture: shader.textures)
-            if(texture->getTextureType()==TextureType::DIFFUSE)
-                texture_color=texture->sample(shader.texcoord.x(), shader.texcoord.y());
-        return texture_color;
+    // k indexes the shared mesh streams, o the instance's transformed copy,
+    // which can lie past 32 bits with many instances of a large mesh
+    uint32_t k[3]={mesh.indices[i], mesh.indices[i+1], mesh.indices[i+2]};
+    size_t o[3]={base+k[0], base+k[1], base+k[2]};
+    uint32_t codes[3]={clip_codes[o[0]], clip_codes[o[1]], clip_codes[o[2]]};
+
+    // all corners outside the same plane
+    if(codes[0]&codes[1]&codes[2]){
+        Profiler::count(ProfileCounter::TRIANGLES_SUBMITTED);
+        Profiler::count(ProfileCounter::TRIANGLES_CULLED);
+        return;
     }
 
-    light_t light({960, 540, 20}, {500, 500, 500});
-    vec3f_t amb_light_intensity{10, 10, 10};
-    vec3f_t eye_pos{900, 540, 10};
-
-    const vec3f_t& ka=shader.ambient;
-    const vec3f_t& kd=texture_color;
-    const vec3f_t& ks=shader.specular;
-    const vec3f_t& point=shader.view_pos;
-    const vec3f_t& normal=shader.normal;
-
-    vec3f_t l=(light.position-point).normalized();
-    vec3f_t v=(eye_pos-point).normalized();
-    vec3f_t h=(l+v).normalized();
-    vec3f_t i=light.intensity/(light.position-point).dot(light.position-point);
-    vec3f_t ambient=ka.cwiseProduct(amb_light_intensity);
-    vec3f_t diffuse=kd.cwiseProduct(i)*std::max(0.0f, normal.dot(l));
-    vec3f_t specular=ks.cwiseProduct(i)*pow(std::max(0.0f, normal.dot(h)), 128);
-    vec3f_t result_color=ambient+diffuse+specular;
-
-    return result_color;
+    // gather vertices, attributes are already deduplicated
+    if(!((codes[0]|codes[1]|codes[2])&Clipper::CLIP_PLANES)){
+        triangle_t triangle;
+        for(int v=0; v<3; v++){
+            triangle.vertices[v]=vertex_t(positions[3*o[v]], positions[3*o[v]+1], positions[3*o[v]+2]);
+            triangle.normals[v]=normal_t(normals[3*o[v]], normals[3*o[v]+1], normals[3*o[v]+2]);
+            triangle.texcoords[v]=texcoord_t(mesh.texcoords[2*k[v]], mesh.texcoords[2*k[v]+1]);
+            triangle.colors[v]=color_t(mesh.colors[3*k[v]], mesh.colors[3*k[v]+1], mesh.colors[3*k[v]+2]);
+        }
+        rasterizer.binTriangle(triangle, info);
+        return;
+    }
+
+    // crosses near, far or the guard band: clip before the divide
+    Clipper::Polygon polygon;
+    for(int v=0; v<3; v++){
+        polygon[v].position=Eigen::Map<const vec4f_t>(&clip_positions[4*o[v]]);
+        polygon[v].normal=normal_t(normals[3*o[v]], normals[3*o[v]+1], normals[3*o[v]+2]);
+        polygon[v].texcoord=texcoord_t(mesh.texcoords[2*k[v]], mesh.texcoords[2*k[v]+1]);
+        polygon[v].color=color_t(mesh.colors[3*k[v]], mesh.colors[3*k[v]+1], mesh.colors[3*k[v]+2]);
+    }
+    Profiler::count(ProfileCounter::TRIANGLES_CLIPPED);
+    int count=Clipper::clip(polygon, (codes[0]|codes[1]|codes[2])&Clipper::CLIP_PLANES);
+    if(count<3 || polygon[0].position[3]<=0.f){
+        Profiler::count(ProfileCounter::TRIANGLES_SUBMITTED);
+        Profiler::count(ProfileCounter::TRIANGLES_CULLED);
+        return;
+    }
+
+    // the clipped polygon is convex, emit it as a fan
+    for(int v=0; v<count; v++)
+        polygon[v].position.head<3>()/=polygon[v].position[3];
+    for(int v=1; v+1<count; v++){
+        triangle_t triangle;
+        for(int j=0; j<3; j++){
+            const ClipVertex& corner=polygon[j==0 ? 0 : v+j-1];
+            triangle.vertices[j]=corner.position.head<3>();
+            triangle.normals[j]=corner.normal;
+            triangle.texcoords[j]=corner.texcoord;
+            triangle.colors[j]=corner.color;
+        }
+        rasterizer.binTriangle(triangle, info);
+    }
 }
@@ -1,45 +1,118 @@
 #pragma once
 
+#include <span>
+
 #include "global.hpp"
 #include "Model.hpp"
+#include "Rasterizer.hpp"
+#include "ShaderProgram.hpp"
 
-struct ShaderInfo{
-    direct_t   view_pos;
-    color_t    color;
-    normal_t   normal;
-    texcoord_t texcoord;
-
-    vec3f_t ambient;
-    vec3f_t diffuse;
-    vec3f_t specular;
-
-    std::vector<Texture*> textures;
+// one copy of the bound model in an instanced draw
+struct Instance{
+    matrix_t model_mat=matrix_t::Identity();
+    vec3f_t  tint=vec3f_t::Ones();      // multiplies the albedo
 };
 
 class Shader{
 private:
-    Model    origin_model;
-    Model    current_model;
+    // per visible instance, matrices for its slot of the buffers
+    struct InstanceTransform{
+        matrix_t mvp_mat;
+        mat3f_t  normal_mat;
+    };
+    // a run of vertices of one slot transformed as one unit of work
+    struct Span{
+        uint32_t slot;
+        long     begin, end;
+        bool     culled;    // only the vertices marked in used_vertices
+    };
+
+    // the bound model is shared and never modified, transformed attributes
+    // go to buffers that are reused from frame to frame; they hold one copy
+    // of the mesh per instance that survived culling, in visible_instances order
+    const Model*          model_ptr;
+    std::vector<float>    clip_positions;   // xyzw per vertex, before the divide by w
+    std::vector<float>    positions;        // screen space, only where no clip plane is crossed
+    std::vector<float>    normals;
+    std::vector<uint32_t> clip_codes;       // Clipper outcode per vertex
+    std::vector<uint8_t>  visible_ranges;   // per visible instance and draw range, cleared by frustum culling
+    std::vector<uint8_t>  range_lods;       // per visible instance and draw range, level of detail drawn
+    std::vector<uint8_t>  visible_meshlets; // per visible instance and meshlet of the drawn levels
+    std::vector<uint8_t>  used_vertices;    // per vertex copy, only these are transformed
+    std::vector<uint32_t> visible_instances;
+    std::vector<InstanceTransform> transforms;  // per visible instance
+    std::vector<Span>     spans;
+
+    // instanced draws share the mesh and its materials, without instances
+    // the model matrix draws a single copy
+    std::vector<Instance> instances;
+
     direct_t view_pos;
     matrix_t model_mat;
     matrix_t view_mat;
     matrix_t projection_mat;
 
+    // world space point lights, binned to screen tiles in render
+    std::vector<light_t> lights;
+
+    // size of the render target the projection maps to
+    float target_width;
+    float target_height;
+
+    // screen-space error in pixels a coarser level of detail may add, 0
+    // always draws full detail
+    float lod_error;
+
+    // bound program, the rasterizer is instantiated for it once in setProgram,
+    // and once more for draws without lights as UnlitProgram
+    uint32_t varyings;
+    void   (*draw_bins)(Rasterizer& rasterizer);
+    void   (*draw_bins_unlit)(Rasterizer& rasterizer);
+
+    std::span<const Instance> getDraws(const Instance& single) const;
+    // coarsest level of the range whose error projects below lod_error
+    uint32_t selectLod(const Mesh& mesh, const DrawRange& range, const matrix_t& mvp_mat) const;
+    // clips and bins the triangle at index i of the mesh, the transformed
+    // copy starts at vertex base
+    void assemble(Rasterizer& rasterizer, const Mesh& mesh, uint32_t i, size_t base, uint32_t info);
+
 public:
     Shader();
 
+    // the model is shared and only read, it has to outlive the draw
+    void bind(const Model* model);
     void setViewPos(const direct_t& view_pos);
     void setModel(const matrix_t& model_mat);
+    // one copy of the model per instance, an empty list goes back to the
+    // model matrix
+    void setInstances(const std::vector<Instance>& instances);
+    const std::vector<Instance>& getInstances() const {return instances;}
     void setView(const matrix_t& view_mat);
     void setProjection(const matrix_t& projection_mat);
+    void setTargetSize(int width, int height);
+    void setLodError(float pixels)  {lod_error=pixels;}
+    float getLodError() const       {return lod_error;}
+    // an empty list leaves the programs on their default light
+    void setLights(const std::vector<light_t>& lights);
+    const std::vector<light_t>& getLights() const {return lights;}
+
+    template<ShaderProgram P>
+    void setProgram();
 
-    void use();
     void flush();
     void transform();
-    void render();
-
-    static color_t phongShader(const ShaderInfo& shader);
-    static color_t textureShader(const ShaderInfo& shader);
-
-friend class Pipeline;
+    // bins the transformed model into the rasterizer's tiles, any number of
+    // models can be binned before the tiles are drawn
+    void render(Rasterizer& rasterizer);
+    // bins every light by the screen bounds of its box, once per frame
+    void binLights(Rasterizer& rasterizer);
+    void drawBins(Rasterizer& rasterizer) {(lights.empty() ? draw_bins_unlit : draw_bins)(rasterizer);}
 };
+
+template<ShaderProgram P>
+void Shader::setProgram()
+{
+    varyings=P::VARYINGS;
+    draw_bins=[](Rasterizer& rasterizer){ rasterizer.drawBins<P>(); };
+    draw_bins_unlit=[](Rasterizer& rasterizer){ rasterizer.drawBins<UnlitProgram<P>>(); };
+}
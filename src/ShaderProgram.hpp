@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <span>
+
+#include "global.hpp"
+#include "ShadowMap.hpp"
+#include "Texture.hpp"
+
+// per-triangle inputs, shared by every fragment of the triangle
+struct ShaderInfo{
+    direct_t view_pos=direct_t::Zero();
+    // screen x, y and depth back to world space, for Varying::POSITION
+    matrix_t screen_to_world=matrix_t::Identity();
+    // a light list was bound, programs fall back to their default light otherwise
+    bool     lit=false;
+    // per-instance color, multiplies the albedo
+    vec3f_t  tint=vec3f_t::Ones();
+
+    vec3f_t ambient=vec3f_t::Zero();
+    vec3f_t diffuse=vec3f_t::Zero();
+    vec3f_t specular=vec3f_t::Zero();
+
+    // one slot per texture type, null when the material has none
+    const Texture* diffuse_texture=nullptr;
+    const Texture* specular_texture=nullptr;
+    const Texture* bump_texture=nullptr;
+};
+
+// attributes a program reads, only these are transformed and interpolated
+struct Varying{
+    static constexpr uint32_t NORMAL=1<<0;
+    static constexpr uint32_t TEXCOORD=1<<1;   // includes the screen-space derivatives
+    static constexpr uint32_t COLOR=1<<2;
+    static constexpr uint32_t POSITION=1<<3;   // world space, reconstructed from depth
+};
+
+// interpolated inputs of one fragment, fields outside the program's
+// varyings are left unset
+struct Fragment{
+    int        x, y;
+    float      z;
+    normal_t   normal;
+    texcoord_t texcoord;
+    vec2f_t    texcoord_dx;     // texcoord change per pixel step in x
+    vec2f_t    texcoord_dy;     // and in y
+    color_t    color;
+    vec3f_t    position;
+    // lights that can reach the fragment, culled per screen tile
+    std::span<const light_t> lights;
+};
+
+// A shader program is a type with a VARYINGS mask and a static shade
+// function. The rasterizer is instantiated per program, so shade is
+// inlined into the pixel loop and attributes it doesn't declare cost nothing.
+// A program may also declare UNLIT_VARYINGS, the subset it reads while
+// ShaderInfo::lit is false; unlit draws then run UnlitProgram<P>.
+template<typename P>
+concept ShaderProgram=requires(const Fragment& fragment, const ShaderInfo& info){
+    {P::VARYINGS}->std::convertible_to<uint32_t>;
+    {P::shade(fragment, info)}->std::convertible_to<color_t>;
+};
+
+// Blinn-Phong over the fragment's tile lights with the material ambient,
+// lights with a shadow map are attenuated by its filtered visibility
+inline color_t shadeLights(const Fragment& fragment, const ShaderInfo& info, const vec3f_t& albedo)
+{
+    const vec3f_t& point=fragment.position;
+    const vec3f_t& normal=fragment.normal;
+    vec3f_t v=(info.view_pos-point).normalized();
+
+    color_t result=info.ambient.cwiseProduct(albedo);
+    for(const light_t& light: fragment.lights){
+        vec3f_t d=light.position-point;
+        float distance2=d.dot(d);
+        if(!(distance2<light.radius*light.radius))
+            continue;
+
+        float visibility=light.shadow_map ? light.shadow_map->visibility(point, normal) : 1.f;
+        if(visibility==0.f)
+            continue;
+
+        // the window takes the falloff to exactly zero at the radius
+        float fade=1.f-distance2*distance2/(light.radius*light.radius*light.radius*light.radius);
+        vec3f_t l=d/std::sqrt(distance2);
+        vec3f_t h=(l+v).normalized();
+        vec3f_t i=light.intensity*(fade*fade/distance2*visibility);
+
+        float diffuse=std::max(0.f, normal.dot(l));
+        float specular=std::pow(std::max(0.f, normal.dot(h)), 128.f);
+        result+=(albedo*diffuse+info.specular*specular).cwiseProduct(i);
+    }
+    return result;
+}
+
+// Blinn-Phong with the bound lights, or one default point light; the
+// vertex color is the diffuse albedo
+struct PhongProgram{
+    static constexpr uint32_t VARYINGS=Varying::NORMAL|Varying::COLOR|Varying::POSITION;
+    static constexpr uint32_t UNLIT_VARYINGS=Varying::NORMAL|Varying::COLOR;
+
+    static color_t shade(const Fragment& fragment, const ShaderInfo& info)
+    {
+        vec3f_t albedo=fragment.color.cwiseProduct(info.tint);
+        if(info.lit)
+            return shadeLights(fragment, info, albedo);
+
+        light_t light({20, 20, 20}, {500, 500, 500});
+        vec3f_t amb_light_intensity{10, 10, 10};
+        vec3f_t eye_pos{0, 0, 10};
+
+        const vec3f_t& point=info.view_pos;
+        const vec3f_t& normal=fragment.normal;
+
+        vec3f_t l=(light.position-point).normalized();
+        vec3f_t v=(eye_pos-point).normalized();
+        vec3f_t h=(l+v).normalized();
+        vec3f_t i=light.intensity/(light.position-point).dot(light.position-point);
+
+        vec3f_t ambient=info.ambient.cwiseProduct(amb_light_intensity);
+        vec3f_t diffuse=albedo.cwiseProduct(i)*std::max(0.0f, normal.dot(l));
+        vec3f_t specular=info.specular.cwiseProduct(i)*std::pow(std::max(0.0f, normal.dot(h)), 128.f);
+        return ambient+diffuse+specular;
+    }
+};
+
+// diffuse texture lit by the bound lights; without lights it is unlit and
+// untextured materials fall back to a lit default
+struct TextureProgram{
+    static constexpr uint32_t VARYINGS=Varying::NORMAL|Varying::TEXCOORD|Varying::POSITION;
+    static constexpr uint32_t UNLIT_VARYINGS=Varying::NORMAL|Varying::TEXCOORD;
+
+    static color_t shade(const Fragment& fragment, const ShaderInfo& info)
+    {
+        if(info.lit){
+            vec3f_t albedo=info.diffuse_texture
+                ? info.diffuse_texture->sample(fragment.texcoord, fragment.texcoord_dx, fragment.texcoord_dy)
+                : vec3f_t::Ones();
+            return shadeLights(fragment, info, albedo.cwiseProduct(info.tint));
+        }
+        if(info.diffuse_texture)
+            return info.diffuse_texture->sample(fragment.texcoord, fragment.texcoord_dx, fragment.texcoord_dy).cwiseProduct(info.tint);
+
+        light_t light({960, 540, 20}, {500, 500, 500});
+        vec3f_t amb_light_intensity{10, 10, 10};
+        vec3f_t eye_pos{900, 540, 10};
+
+        const vec3f_t kd=vec3f_t::Identity().cwiseProduct(info.tint);
+        const vec3f_t& point=info.view_pos;
+        const vec3f_t& normal=fragment.normal;
+
+        vec3f_t l=(light.position-point).normalized();
+        vec3f_t v=(eye_pos-point).normalized();
+        vec3f_t h=(l+v).normalized();
+        vec3f_t i=light.intensity/(light.position-point).dot(light.position-point);
+
+        vec3f_t ambient=info.ambient.cwiseProduct(amb_light_intensity);
+        vec3f_t diffuse=kd.cwiseProduct(i)*std::max(0.0f, normal.dot(l));
+        vec3f_t specular=info.specular.cwiseProduct(i)*std::pow(std::max(0.0f, normal.dot(h)), 128.f);
+        return ambient+diffuse+specular;
+    }
+};
+
+// no varyings at all, for depth-only passes where shade is never called
+struct DepthProgram{
+    static constexpr uint32_t VARYINGS=0;
+
+    static color_t shade(const Fragment&, const ShaderInfo&) {return color_t::Zero();}
+};
+
+// P restricted to the varyings it reads without lights, all of them unless
+// it declares UNLIT_VARYINGS
+template<ShaderProgram P>
+struct UnlitProgram{
+    static constexpr uint32_t VARYINGS=[]{
+        if constexpr(requires{P::UNLIT_VARYINGS;})
+            return static_cast<uint32_t>(P::UNLIT_VARYINGS);
+        else
+            return static_cast<uint32_t>(P::VARYINGS);
+    }();
+    static_assert((VARYINGS&~P::VARYINGS)==0, "UNLIT_VARYINGS must be a subset of VARYINGS");
+
+    static color_t shade(const Fragment& fragment, const ShaderInfo& info) {return P::shade(fragment, info);}
+};
+
+static_assert(ShaderProgram<PhongProgram>);
+static_assert(ShaderProgram<TextureProgram>);
+static_assert(ShaderProgram<DepthProgram>);
+static_assert(ShaderProgram<UnlitProgram<TextureProgram>>);
@@ -0,0 +1,68 @@
+#include "ShadowMap.hpp"
+#include "Geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+ShadowMap::ShadowMap(int size)
+: size(size),
+  depth(size*size, std::numeric_limits<float>::max()),
+  view_mat(matrix_t::Identity()),
+  projection_mat(matrix_t::Identity()),
+  world_to_map(matrix_t::Identity())
+{
+}
+
+void ShadowMap::setLight(const matrix_t& view_mat, const matrix_t& projection_mat)
+{
+    this->view_mat=view_mat;
+    this->projection_mat=Geometry::viewport(0.f, 0.f, size, size, 0.f, 1.f)*projection_mat;
+    world_to_map=this->projection_mat*view_mat;
+}
+
+float ShadowMap::visibility(const vec3f_t& position, const normal_t& normal) const
+{
+    vec4f_t p=world_to_map*position.homogeneous();
+    if(p.w()<=0.f)
+        return 1.f;
+    // a texel spans w/scale world units at the point's distance
+    float texel=p.w()/std::abs(projection_mat(0, 0));
+    p=world_to_map*(position+normal*(texel*normal_offset)).homogeneous();
+    if(p.w()<=0.f)
+        return 1.f;
+
+    // texel centers sit at +0.5, so the lower left texel of the bilinear
+    // footprint starts half a texel down
+    float x=p.x()/p.w()-0.5f;
+    float y=p.y()/p.w()-0.5f;
+    float z=p.z()/p.w()-bias;
+    if(!(z<=1.f))
+        return 1.f;
+
+    int x0=static_cast<int>(std::floor(x))-filter_radius;
+    int y0=static_cast<int>(std::floor(y))-filter_radius;
+    float fx=x-std::floor(x), fy=y-std::floor(y);
+
+    // one depth comparison per texel of the footprint, texels off the map are lit
+    const int n=2*filter_radius+2;
+    float lit[2*MAX_FILTER_RADIUS+2][2*MAX_FILTER_RADIUS+2];
+    for(int j=0; j<n; j++){
+        for(int i=0; i<n; i++){
+            int tx=x0+i, ty=y0+j;
+            bool inside=tx>=0 && ty>=0 && tx<size && ty<size;
+            lit[j][i]=!inside || z<=depth[ty*size+tx] ? 1.f : 0.f;
+        }
+    }
+
+    // every kernel tap filters its four comparisons bilinearly
+    float sum=0.f;
+    for(int j=0; j+1<n; j++){
+        for(int i=0; i+1<n; i++){
+            float bottom=lit[j][i]+(lit[j][i+1]-lit[j][i])*fx;
+            float top=lit[j+1][i]+(lit[j+1][i+1]-lit[j+1][i])*fx;
+            sum+=bottom+(top-bottom)*fy;
+        }
+    }
+    return sum/((n-1)*(n-1));
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "global.hpp"
+
+// Depth of the scene as seen from a light, rendered by
+// RenderContext::renderShadow with a depth-only pass and looked up from the
+// fragment stage. The light's projection is the usual one to [-1, 1], the
+// map adds its own viewport.
+class ShadowMap{
+public:
+    static constexpr int MAX_FILTER_RADIUS=3;
+
+private:
+    int                size;
+    std::vector<float> depth;
+    matrix_t           view_mat;
+    matrix_t           projection_mat;     // including the viewport to map texels
+    matrix_t           world_to_map;
+    // keep lit surfaces from shadowing themselves: a constant depth offset
+    // and a push along the normal in texels, which grows at grazing angles
+    float              bias=0.0005f;
+    float              normal_offset=1.5f;
+    int                filter_radius=1;    // PCF over (2r+1)^2 bilinear taps
+
+public:
+    explicit ShadowMap(int size=1024);
+
+    void setLight(const matrix_t& view_mat, const matrix_t& projection_mat);
+    void setBias(float bias, float normal_offset) {this->bias=bias; this->normal_offset=normal_offset;}
+    void setFilterRadius(int radius)    {filter_radius=std::clamp(radius, 0, MAX_FILTER_RADIUS);}
+    int  getSize() const                {return size;}
+    const std::vector<float>& getDepth() const {return depth;}
+
+    // fraction of the filter footprint around the world space point that
+    // the light reaches, 1 outside the map
+    float visibility(const vec3f_t& position, const normal_t& normal) const;
+
+friend class RenderContext;
+};
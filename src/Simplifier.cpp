@@ -0,0 +1,237 @@
+#include "Simplifier.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <tuple>
+
+Simplifier::Simplifier(std::span<const float> positions, uint32_t vertex_offset, uint32_t vertex_count,
+    std::span<const uint32_t> indices, std::span<const int> material_ids)
+: positions(positions), vertex_offset(vertex_offset),
+  triangles(indices.begin(), indices.end()),
+  material_ids(material_ids.begin(), material_ids.end()),
+  alive(indices.size()/3, 1),
+  quadrics(vertex_count, Eigen::Matrix4d::Zero()),
+  plane_counts(vertex_count, 0.0),
+  locked(vertex_count, 0),
+  removed(vertex_count, 0),
+  triangle_count(indices.size()/3),
+  error(0.f)
+{
+    // every plane counts the same, the error is a sum of squared distances
+    for(size_t t=0; t<triangle_count; t++){
+        vec3f_t a=position(triangles[3*t]), b=position(triangles[3*t+1]), c=position(triangles[3*t+2]);
+        vec3f_t normal=(b-a).cross(c-a);
+        if(normal.squaredNorm()==0.f)
+            continue;
+        normal.normalize();
+        Eigen::Vector4d plane(normal.x(), normal.y(), normal.z(), -normal.dot(a));
+        Eigen::Matrix4d quadric=plane*plane.transpose();
+        for(int k=0; k<3; k++){
+            quadrics[triangles[3*t+k]-vertex_offset]+=quadric;
+            plane_counts[triangles[3*t+k]-vertex_offset]+=1.0;
+        }
+    }
+    lockBoundaries();
+}
+
+void Simplifier::lockBoundaries()
+{
+    const uint32_t vertex_count=static_cast<uint32_t>(locked.size());
+
+    // vertices at the same position differ in some other attribute: they
+    // sit on a seam, and so does everything sharing their position
+    std::vector<uint32_t> order(vertex_count);
+    std::iota(order.begin(), order.end(), 0);
+    auto key=[&](uint32_t v){
+        const float* p=&positions[3*(vertex_offset+v)];
+        return std::make_tuple(p[0], p[1], p[2]);
+    };
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){ return key(a)<key(b); });
+    std::vector<uint32_t> group(vertex_count);
+    std::vector<uint32_t> group_size;
+    for(uint32_t i=0; i<vertex_count; i++){
+        if(i==0 || key(order[i])!=key(order[i-1]))
+            group_size.push_back(0);
+        group[order[i]]=static_cast<uint32_t>(group_size.size()-1);
+        group_size.back()++;
+    }
+    std::vector<uint8_t> locked_group(group_size.size(), 0);
+    for(size_t g=0; g<group_size.size(); g++)
+        locked_group[g]=group_size[g]>1;
+
+    // vertices shared by triangles of different materials
+    std::vector<int> vertex_material(vertex_count, INT_MIN);
+    for(size_t t=0; t<triangle_count; t++){
+        for(int k=0; k<3; k++){
+            uint32_t v=triangles[3*t+k]-vertex_offset;
+            if(vertex_material[v]==INT_MIN)
+                vertex_material[v]=material_ids[t];
+            else if(vertex_material[v]!=material_ids[t])
+                locked_group[group[v]]=1;
+        }
+    }
+
+    // edges between positions that don't have exactly two triangles are
+    // open borders or non-manifold
+    std::vector<uint64_t> edges;
+    edges.reserve(3*triangle_count);
+    for(size_t t=0; t<triangle_count; t++){
+        for(int k=0; k<3; k++){
+            uint32_t a=group[triangles[3*t+k]-vertex_offset];
+            uint32_t b=group[triangles[3*t+(k+1)%3]-vertex_offset];
+            if(a!=b)
+                edges.push_back(uint64_t(std::min(a, b))<<32|std::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for(size_t i=0; i<edges.size();){
+        size_t j=i;
+        while(j<edges.size() && edges[j]==edges[i])
+            j++;
+        if(j-i!=2){
+            locked_group[edges[i]>>32]=1;
+            locked_group[edges[i]&0xffffffffu]=1;
+        }
+        i=j;
+    }
+
+    for(uint32_t v=0; v<vertex_count; v++)
+        locked[v]=locked_group[group[v]];
+}
+
+bool Simplifier::keepsOrientation(uint32_t u, uint32_t v, std::span<const uint32_t> u_triangles) const
+{
+    vec3f_t target=position(v);
+    for(uint32_t t: u_triangles){
+        if(!alive[t])
+            continue;
+        const uint32_t* corners=&triangles[3*t];
+        if(corners[0]==v || corners[1]==v || corners[2]==v)
+            continue;
+
+        vec3f_t p[3], moved[3];
+        for(int k=0; k<3; k++){
+            p[k]=position(corners[k]);
+            moved[k]=corners[k]==u ? target : p[k];
+        }
+        vec3f_t before=(p[1]-p[0]).cross(p[2]-p[0]);
+        vec3f_t after=(moved[1]-moved[0]).cross(moved[2]-moved[0]);
+        // no flips, no slivers and no turns past about 80 degrees
+        if(after.dot(before)<=0.2f*after.norm()*before.norm())
+            return false;
+    }
+    return true;
+}
+
+bool Simplifier::simplify(size_t target)
+{
+    const uint32_t vertex_count=static_cast<uint32_t>(locked.size());
+    bool progress=false;
+
+    while(triangle_count>target){
+        // triangles around every vertex, rebuilt once per pass
+        std::vector<uint32_t> offsets(vertex_count+1, 0);
+        for(size_t t=0; t<alive.size(); t++)
+            if(alive[t])
+                for(int k=0; k<3; k++)
+                    offsets[triangles[3*t+k]-vertex_offset+1]++;
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        std::vector<uint32_t> adjacency(offsets.back());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end()-1);
+        for(size_t t=0; t<alive.size(); t++)
+            if(alive[t])
+                for(int k=0; k<3; k++)
+                    adjacency[fill[triangles[3*t+k]-vertex_offset]++]=static_cast<uint32_t>(t);
+
+        // the cheapest neighbour every free vertex can move onto without
+        // turning a triangle over
+        struct Candidate{
+            double   cost;
+            uint32_t u, v;
+        };
+        std::vector<Candidate> candidates;
+        std::vector<Candidate> targets;
+        for(uint32_t u=0; u<vertex_count; u++){
+            if(locked[u] || removed[u] || offsets[u]==offsets[u+1])
+                continue;
+            std::span<const uint32_t> u_triangles(adjacency.data()+offsets[u], offsets[u+1]-offsets[u]);
+            targets.clear();
+            for(uint32_t t: u_triangles){
+                for(int k=0; k<3; k++){
+                    uint32_t v=triangles[3*t+k]-vertex_offset;
+                    if(v==u)
+                        continue;
+                    Eigen::Vector4d p=position(v+vertex_offset).cast<double>().homogeneous();
+                    double planes=std::max(plane_counts[u]+plane_counts[v], 1.0);
+                    targets.push_back({p.dot((quadrics[u]+quadrics[v])*p)/planes, u, v});
+                }
+            }
+            std::sort(targets.begin(), targets.end(), [](const Candidate& a, const Candidate& b){
+                return a.cost<b.cost || (a.cost==b.cost && a.v<b.v);
+            });
+            for(size_t i=0; i<targets.size(); i++){
+                if(i>0 && targets[i].v==targets[i-1].v)
+                    continue;
+                if(keepsOrientation(u+vertex_offset, targets[i].v+vertex_offset, u_triangles)){
+                    candidates.push_back(targets[i]);
+                    break;
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b){
+            return a.cost<b.cost || (a.cost==b.cost && a.u<b.u);
+        });
+
+        // the cheapest third per pass, collapses change the costs around them
+        size_t limit=std::max<size_t>(candidates.size()/3, 1);
+        std::vector<uint8_t> touched(vertex_count, 0);
+        size_t collapsed=0;
+        for(size_t i=0; i<std::min(limit, candidates.size()) && triangle_count>target; i++){
+            auto [cost, u, v]=candidates[i];
+            // untouched vertices still have the triangles they were checked with
+            if(touched[u] || touched[v])
+                continue;
+            std::span<const uint32_t> u_triangles(adjacency.data()+offsets[u], offsets[u+1]-offsets[u]);
+
+            for(uint32_t t: u_triangles){
+                if(!alive[t])
+                    continue;
+                uint32_t* corners=&triangles[3*t];
+                if(corners[0]==v+vertex_offset || corners[1]==v+vertex_offset || corners[2]==v+vertex_offset){
+                    alive[t]=0;
+                    triangle_count--;
+                }
+                for(int k=0; k<3; k++){
+                    if(corners[k]==u+vertex_offset)
+                        corners[k]=v+vertex_offset;
+                    touched[corners[k]-vertex_offset]=1;
+                }
+            }
+            touched[u]=1;
+            quadrics[v]+=quadrics[u];
+            plane_counts[v]+=plane_counts[u];
+            removed[u]=1;
+            error=std::max(error, static_cast<float>(std::sqrt(std::max(cost, 0.0))));
+            collapsed++;
+        }
+        if(collapsed==0)
+            break;
+        progress=true;
+    }
+    return progress;
+}
+
+void Simplifier::getTriangles(std::vector<uint32_t>& indices, std::vector<int>& material_ids) const
+{
+    indices.clear();
+    material_ids.clear();
+    for(size_t t=0; t<alive.size(); t++){
+        if(!alive[t])
+            continue;
+        indices.insert(indices.end(), triangles.begin()+3*t, triangles.begin()+3*t+3);
+        material_ids.push_back(this->material_ids[t]);
+    }
+}
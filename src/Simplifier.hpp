@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "global.hpp"
+
+// Quadric error edge collapse over the triangles of one draw range. Every
+// collapse moves a vertex onto one of its neighbours, so the simplified
+// triangles use a subset of the original vertices and keep their
+// attributes. Vertices on UV or normal seams, open borders and material
+// boundaries never move, which keeps those edges where they are. Triangles
+// keep their relative order, a material-sorted input stays sorted.
+class Simplifier{
+private:
+    std::span<const float>       positions;
+    uint32_t                     vertex_offset;
+    std::vector<uint32_t>        triangles;          // absolute indices, collapses rewrite them in place
+    std::vector<int>             material_ids;
+    std::vector<uint8_t>         alive;              // per triangle
+    std::vector<Eigen::Matrix4d> quadrics;           // per vertex, summed planes of its triangles
+    std::vector<double>          plane_counts;       // planes in each quadric
+    std::vector<uint8_t>         locked;
+    std::vector<uint8_t>         removed;
+    size_t                       triangle_count;
+    float                        error;
+
+    vec3f_t position(uint32_t vertex) const
+    {
+        return vec3f_t(positions[3*vertex], positions[3*vertex+1], positions[3*vertex+2]);
+    }
+    void lockBoundaries();
+    // moving u onto v turns no remaining triangle of u over
+    bool keepsOrientation(uint32_t u, uint32_t v, std::span<const uint32_t> u_triangles) const;
+
+public:
+    Simplifier(std::span<const float> positions, uint32_t vertex_offset, uint32_t vertex_count,
+        std::span<const uint32_t> indices, std::span<const int> material_ids);
+
+    // collapses the cheapest edges until at most target triangles are left
+    // or no edge can move; false when nothing collapsed
+    bool simplify(size_t target);
+
+    size_t getTriangleCount() const             {return triangle_count;}
+    // largest root mean square distance of a collapsed vertex to the
+    // planes it gathered, about the deviation from the input surface in
+    // object units
+    float  getError() const                     {return error;}
+    bool   isRemoved(uint32_t vertex) const     {return removed[vertex-vertex_offset];}
+    // remaining triangles in input order
+    void   getTriangles(std::vector<uint32_t>& indices, std::vector<int>& material_ids) const;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Capacity must be a power of two. waitPop blocks on the tail counter
+// instead of spinning.
+template<typename T, size_t Capacity>
+class SpscQueue{
+    static_assert(Capacity>0 && (Capacity&(Capacity-1))==0, "capacity must be a power of two");
+
+private:
+    T items[Capacity];
+    alignas(64) std::atomic<size_t> head{0};    // next slot to pop, owned by the consumer
+    alignas(64) std::atomic<size_t> tail{0};    // next slot to push, owned by the producer
+
+public:
+    bool push(const T& item)
+    {
+        size_t t=tail.load(std::memory_order_relaxed);
+        if(t-head.load(std::memory_order_acquire)==Capacity)
+            return false;
+        items[t%Capacity]=item;
+        tail.store(t+1, std::memory_order_release);
+        tail.notify_one();
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        size_t h=head.load(std::memory_order_relaxed);
+        if(h==tail.load(std::memory_order_acquire))
+            return false;
+        item=items[h%Capacity];
+        head.store(h+1, std::memory_order_release);
+        return true;
+    }
+
+    void waitPop(T& item)
+    {
+        while(!pop(item))
+            tail.wait(head.load(std::memory_order_relaxed), std::memory_order_acquire);
+    }
+};
@@ -1,39 +1,407 @@
 #define STB_IMAGE_IMPLEMENTATION
 
 #include "Texture.hpp"
+#include "Color.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <string>
-#include <iostream>
+#include <stdexcept>
+#include <utility>
 
-Texture::Texture(std::string file_path, TextureType type)
+static std::atomic<uint32_t> next_texture_id{1};
+
+static int wordsPerTile(TextureFormat format)
+{
+    switch(format){
+    case TextureFormat::BC1: return 2;
+    case TextureFormat::BC3: return 4;
+    default:                 return 16;
+    }
+}
+
+static inline uint32_t packRGBA8(const vec4f_t& color, bool srgb)
+{
+    if(srgb)
+        return packSrgb(color.head<3>(), color.w());
+
+    uint32_t packed=0;
+    for(int k=0; k<4; k++)
+        packed|=static_cast<uint32_t>(std::clamp(color[k], 0.f, 1.f)*255.f+0.5f)<<(8*k);
+    return packed;
+}
+
+// texel offset inside a 4x4 tile, bits interleaved as y1 x1 y0 x0
+static inline int morton4(int x, int y)
+{
+    return (x&1)|((y&1)<<1)|((x&2)<<1)|((y&2)<<2);
+}
+
+static inline uint32_t rgb565To888(uint32_t c)
+{
+    uint32_t r=(c>>11)&31, g=(c>>5)&63, b=c&31;
+    return ((r<<3)|(r>>2))|(((g<<2)|(g>>4))<<8)|(((b<<3)|(b>>2))<<16);
+}
+
+static inline uint32_t rgb888To565(uint32_t c)
+{
+    uint32_t r=c&0xff, g=(c>>8)&0xff, b=(c>>16)&0xff;
+    return ((r*31+127)/255)<<11|((g*63+127)/255)<<5|((b*31+127)/255);
+}
+
+static inline uint32_t mixRGB(uint32_t a, uint32_t b, int wa, int wb)
+{
+    uint32_t mixed=0;
+    for(int k=0; k<3; k++){
+        uint32_t ca=(a>>(8*k))&0xff, cb=(b>>(8*k))&0xff;
+        mixed|=((ca*wa+cb*wb)/(wa+wb))<<(8*k);
+    }
+    return mixed;
+}
+
+// 4 palette entries of a bc1 color block, alpha in the top byte
+static void colorPalette(uint32_t c0, uint32_t c1, bool allow_three_color, uint32_t palette[4])
+{
+    uint32_t p0=rgb565To888(c0), p1=rgb565To888(c1);
+    palette[0]=p0|0xff000000u;
+    palette[1]=p1|0xff000000u;
+    if(c0>c1 || !allow_three_color){
+        palette[2]=mixRGB(p0, p1, 2, 1)|0xff000000u;
+        palette[3]=mixRGB(p0, p1, 1, 2)|0xff000000u;
+    }else{
+        palette[2]=mixRGB(p0, p1, 1, 1)|0xff000000u;
+        palette[3]=0;
+    }
+}
+
+static void alphaPalette(uint32_t a0, uint32_t a1, uint32_t palette[8])
+{
+    palette[0]=a0;
+    palette[1]=a1;
+    if(a0>a1){
+        for(uint32_t i=1; i<7; i++)
+            palette[i+1]=((7-i)*a0+i*a1)/7;
+    }else{
+        for(uint32_t i=1; i<5; i++)
+            palette[i+1]=((5-i)*a0+i*a1)/5;
+        palette[6]=0;
+        palette[7]=255;
+    }
+}
+
+static int colorDistance(uint32_t a, uint32_t b)
+{
+    int distance=0;
+    for(int k=0; k<3; k++){
+        int d=static_cast<int>((a>>(8*k))&0xff)-static_cast<int>((b>>(8*k))&0xff);
+        distance+=d*d;
+    }
+    return distance;
+}
+
+// bounding box endpoints inset by 1/16 of the range, always four-color mode
+static void encodeColorBlock(const uint32_t texels[16], uint32_t out[2])
+{
+    int lo[3]={255, 255, 255}, hi[3]={0, 0, 0};
+    for(int i=0; i<16; i++){
+        for(int k=0; k<3; k++){
+            int c=(texels[i]>>(8*k))&0xff;
+            lo[k]=std::min(lo[k], c);
+            hi[k]=std::max(hi[k], c);
+        }
+    }
+
+    uint32_t max_color=0, min_color=0;
+    for(int k=0; k<3; k++){
+        int inset=(hi[k]-lo[k])/16;
+        max_color|=static_cast<uint32_t>(hi[k]-inset)<<(8*k);
+        min_color|=static_cast<uint32_t>(lo[k]+inset)<<(8*k);
+    }
+
+    uint32_t c0=rgb888To565(max_color), c1=rgb888To565(min_color);
+    if(c0<c1)
+        std::swap(c0, c1);
+    out[0]=c0|(c1<<16);
+    out[1]=0;
+    if(c0==c1)
+        return;
+
+    uint32_t palette[4];
+    colorPalette(c0, c1, false, palette);
+    for(int i=0; i<16; i++){
+        int best=0, best_distance=colorDistance(texels[i], palette[0]);
+        for(int j=1; j<4; j++){
+            int distance=colorDistance(texels[i], palette[j]);
+            if(distance<best_distance){
+                best=j;
+                best_distance=distance;
+            }
+        }
+        out[1]|=static_cast<uint32_t>(best)<<(2*i);
+    }
+}
+
+static void encodeAlphaBlock(const uint32_t texels[16], uint32_t out[2])
+{
+    uint32_t a0=0, a1=255;
+    for(int i=0; i<16; i++){
+        a0=std::max(a0, texels[i]>>24);
+        a1=std::min(a1, texels[i]>>24);
+    }
+
+    uint64_t bits=a0|(a1<<8);
+    if(a0>a1){
+        uint32_t palette[8];
+        alphaPalette(a0, a1, palette);
+        for(int i=0; i<16; i++){
+            int a=texels[i]>>24, best=0, best_distance=256;
+            for(int j=0; j<8; j++){
+                int distance=std::abs(a-static_cast<int>(palette[j]));
+                if(distance<best_distance){
+                    best=j;
+                    best_distance=distance;
+                }
+            }
+            bits|=static_cast<uint64_t>(best)<<(16+3*i);
+        }
+    }
+    out[0]=static_cast<uint32_t>(bits);
+    out[1]=static_cast<uint32_t>(bits>>32);
+}
+
+// row-major texels of one compressed tile
+static void decodeTile(TextureFormat format, const uint32_t* block, uint32_t texels[16])
+{
+    const uint32_t* color=format==TextureFormat::BC3 ? block+2 : block;
+    uint32_t palette[4];
+    colorPalette(color[0]&0xffff, color[0]>>16, format==TextureFormat::BC1, palette);
+    for(int i=0; i<16; i++)
+        texels[i]=palette[(color[1]>>(2*i))&3];
+
+    if(format!=TextureFormat::BC3)
+        return;
+
+    uint64_t bits=block[0]|(static_cast<uint64_t>(block[1])<<32);
+    uint32_t alpha[8];
+    alphaPalette(bits&0xff, (bits>>8)&0xff, alpha);
+    for(int i=0; i<16; i++)
+        texels[i]=(texels[i]&0xffffff)|(alpha[(bits>>(16+3*i))&7]<<24);
+}
+
+// direct-mapped cache of decoded tiles, one per thread
+struct DecodedTile{
+    uint32_t texture_id;
+    size_t   tile;
+    uint32_t texels[16];
+};
+static thread_local std::array<DecodedTile, 64> decoded_tiles{};
+
+Texture::Texture(std::string file_path, TextureType type, TextureFormat format)
 {
     this->file_path = file_path;
     this->type = type;
-    auto image=stbi_load(file_path.c_str(), &this->width, &this->height, &this->nrChannels, 0); 
+    this->format = format;
+    this->filter = TextureFilter::TRILINEAR;
+    this->srgb = type==TextureType::DIFFUSE;
+    this->id = next_texture_id.fetch_add(1, std::memory_order_relaxed);
+    auto image=stbi_load(file_path.c_str(), &this->width, &this->height, &this->nrChannels, 0);
 
-    if(image==nullptr){
-        std::cerr<<"Failed to load texture "<<file_path<<std::endl;
-        exit(1);
-    }
+    if(image==nullptr)
+        throw std::runtime_error("Failed to load texture "+file_path+": "+stbi_failure_reason());
 
-    data.resize(this->width*this->height);
+    // gray and gray+alpha images are replicated into rgb, mips are filtered
+    // in linear space
+    std::vector<vec4f_t> data(this->width*this->height);
+    int g=nrChannels>=3 ? 1 : 0;
+    int a=nrChannels==4 ? 3 : nrChannels==2 ? 1 : -1;
+    auto channel=[&](unsigned char value){ return srgb ? srgbToLinear(value) : value/255.0f; };
     for(int i=0; i<this->width*this->height; i++)
-        data[i]=color_t(
-            image[i*nrChannels+0]/255.0f,
-            image[i*nrChannels+1]/255.0f,
-            image[i*nrChannels+2]/255.0f
+        data[i]=vec4f_t(
+            channel(image[i*nrChannels+0]),
+            channel(image[i*nrChannels+g]),
+            channel(image[i*nrChannels+2*g]),
+            a>=0 ? image[i*nrChannels+a]/255.0f : 1.0f
         );
 
     stbi_image_free(image);
+    buildMipChain(std::move(data));
+}
+
+Texture::Texture(int width, int height, std::vector<color_t> data, TextureType type, TextureFormat format)
+: width(width), height(height), nrChannels(3), id(next_texture_id.fetch_add(1, std::memory_order_relaxed)),
+  type(type), format(format), filter(TextureFilter::TRILINEAR), srgb(type==TextureType::DIFFUSE)
+{
+    std::vector<vec4f_t> rgba(data.size());
+    for(size_t i=0; i<data.size(); i++)
+        rgba[i]=vec4f_t(data[i].x(), data[i].y(), data[i].z(), 1.f);
+    buildMipChain(std::move(rgba));
+}
+
+void Texture::buildMipChain(std::vector<vec4f_t> data)
+{
+    // tile offsets of every level
+    levels.clear();
+    size_t tile_count=0;
+    for(int w=width, h=height;; w=std::max(1, w/2), h=std::max(1, h/2)){
+        MipLevel level{w, h, (w+TILE_SIZE-1)/TILE_SIZE, tile_count};
+        tile_count+=static_cast<size_t>(level.tiles_x)*((h+TILE_SIZE-1)/TILE_SIZE);
+        levels.push_back(level);
+        if(w==1 && h==1)
+            break;
+    }
+
+    const int tile_words=wordsPerTile(format);
+    words.assign(tile_count*tile_words, 0);
+
+    for(size_t i=0; i<levels.size(); i++){
+        const MipLevel& level=levels[i];
+        int w=level.width, h=level.height;
+
+        // encode this level tile by tile, edge tiles repeat the last texel
+        int tiles_y=(h+TILE_SIZE-1)/TILE_SIZE;
+        for(int ty=0; ty<tiles_y; ty++){
+            for(int tx=0; tx<level.tiles_x; tx++){
+                uint32_t texels[16];
+                for(int y=0; y<TILE_SIZE; y++)
+                    for(int x=0; x<TILE_SIZE; x++){
+                        int sx=std::min(tx*TILE_SIZE+x, w-1), sy=std::min(ty*TILE_SIZE+y, h-1);
+                        texels[y*TILE_SIZE+x]=packRGBA8(data[sy*w+sx], srgb);
+                    }
+
+                uint32_t* out=&words[(level.tile_offset+static_cast<size_t>(ty)*level.tiles_x+tx)*tile_words];
+                if(format==TextureFormat::RGBA8){
+                    for(int k=0; k<16; k++)
+                        out[morton4(k%TILE_SIZE, k/TILE_SIZE)]=texels[k];
+                }else if(format==TextureFormat::BC1){
+                    encodeColorBlock(texels, out);
+                }else{
+                    encodeAlphaBlock(texels, out);
+                    encodeColorBlock(texels, out+2);
+                }
+            }
+        }
+
+        if(i+1==levels.size())
+            break;
+
+        // next level is a 2x2 box filter of this one
+        int nw=levels[i+1].width, nh=levels[i+1].height;
+        std::vector<vec4f_t> next(nw*nh);
+        for(int y=0; y<nh; y++){
+            int y0=std::min(2*y, h-1), y1=std::min(2*y+1, h-1);
+            for(int x=0; x<nw; x++){
+                int x0=std::min(2*x, w-1), x1=std::min(2*x+1, w-1);
+                next[y*nw+x]=(data[y0*w+x0]+data[y0*w+x1]+data[y1*w+x0]+data[y1*w+x1])*0.25f;
+            }
+        }
+        data=std::move(next);
+    }
+}
+
+std::vector<color_t> Texture::getTextureData() const
+{
+    std::vector<color_t> data(width*height);
+    for(int y=0; y<height; y++)
+        for(int x=0; x<width; x++)
+            data[y*width+x]=unpack(fetch(levels[0], x, y));
+    return data;
+}
+
+color_t Texture::unpack(uint32_t texel) const
+{
+    if(srgb)
+        return unpackSrgb(texel);
+    return color_t(texel&0xff, (texel>>8)&0xff, (texel>>16)&0xff)*(1.f/255.f);
 }
 
-color_t Texture::sample(float u, float v) const 
+uint32_t Texture::fetch(const MipLevel& level, int x, int y) const
 {
-    int u_img=u*width;
-    int v_img=v*height;
-    int index=u_img*width+v_img;
-    if(index<0)
-        index=0;
+    size_t tile=level.tile_offset+static_cast<size_t>(y/TILE_SIZE)*level.tiles_x+x/TILE_SIZE;
+    if(format==TextureFormat::RGBA8)
+        return words[tile*16+morton4(x%TILE_SIZE, y%TILE_SIZE)];
+
+    DecodedTile& cached=decoded_tiles[(tile^(static_cast<size_t>(id)*0x9e37))%decoded_tiles.size()];
+    if(cached.texture_id!=id || cached.tile!=tile){
+        decodeTile(format, &words[tile*wordsPerTile(format)], cached.texels);
+        cached.texture_id=id;
+        cached.tile=tile;
+    }
+    return cached.texels[(y%TILE_SIZE)*TILE_SIZE+x%TILE_SIZE];
+}
+
+color_t Texture::sampleNearest(const MipLevel& level, float u, float v) const
+{
+    // wrap, image rows go top-down while v goes up
+    u-=std::floor(u);
+    v-=std::floor(v);
+    int x=std::min(static_cast<int>(u*level.width), level.width-1);
+    int y=std::min(static_cast<int>((1.f-v)*level.height), level.height-1);
+    return unpack(fetch(level, x, y));
+}
 
-    return data[index%data.size()];
+color_t Texture::sampleBilinear(const MipLevel& level, float u, float v) const
+{
+    u-=std::floor(u);
+    v-=std::floor(v);
+    float fx=u*level.width-0.5f;
+    float fy=(1.f-v)*level.height-0.5f;
+    int x0=static_cast<int>(std::floor(fx));
+    int y0=static_cast<int>(std::floor(fy));
+    float tx=fx-x0, ty=fy-y0;
+
+    int x1=x0+1, y1=y0+1;
+    if(x0<0)
+        x0=level.width-1;
+    if(y0<0)
+        y0=level.height-1;
+    if(x1>=level.width)
+        x1=0;
+    if(y1>=level.height)
+        y1=0;
+
+    color_t top=unpack(fetch(level, x0, y0))*(1.f-tx)+unpack(fetch(level, x1, y0))*tx;
+    color_t bottom=unpack(fetch(level, x0, y1))*(1.f-tx)+unpack(fetch(level, x1, y1))*tx;
+    return top*(1.f-ty)+bottom*ty;
+}
+
+float Texture::getLod(const vec2f_t& duv_dx, const vec2f_t& duv_dy) const
+{
+    // texels covered by one pixel step along the longer axis
+    vec2f_t size(static_cast<float>(width), static_cast<float>(height));
+    float rho2=std::max(duv_dx.cwiseProduct(size).squaredNorm(), duv_dy.cwiseProduct(size).squaredNorm());
+    return rho2>0.f ? 0.5f*std::log2(rho2) : 0.f;
+}
+
+color_t Texture::sample(float u, float v) const
+{
+    return sample(u, v, 0.f);
+}
+
+color_t Texture::sample(float u, float v, float lod) const
+{
+    int last=static_cast<int>(levels.size())-1;
+    lod=std::clamp(lod, 0.f, static_cast<float>(last));
+
+    switch(filter){
+    case TextureFilter::NEAREST:
+        return sampleNearest(levels[static_cast<int>(lod+0.5f)], u, v);
+    case TextureFilter::BILINEAR:
+        return sampleBilinear(levels[static_cast<int>(lod+0.5f)], u, v);
+    default:
+        break;
+    }
+
+    int level=static_cast<int>(lod);
+    float t=lod-level;
+    color_t color=sampleBilinear(levels[level], u, v);
+    if(t>0.f && level<last)
+        color=color*(1.f-t)+sampleBilinear(levels[level+1], u, v)*t;
+    return color;
+}
+
+color_t Texture::sample(const texcoord_t& uv, const vec2f_t& duv_dx, const vec2f_t& duv_dy) const
+{
+    return sample(uv.x(), uv.y(), getLod(duv_dx, duv_dy));
 }
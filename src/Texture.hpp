@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #include "global.hpp"
@@ -11,25 +12,79 @@ enum TextureType {
     BUMP
 };
 
+enum class TextureFilter{
+    NEAREST,
+    BILINEAR,
+    TRILINEAR
+};
+
+// in-memory texel format, every format stores 4x4 texel tiles
+enum class TextureFormat{
+    RGBA8,  // 64 bytes per tile
+    BC1,    // 8 bytes per tile, rgb with 1-bit alpha
+    BC3     // 16 bytes per tile, rgb with interpolated alpha
+};
+
+// one level of the mip chain, tiles start at tile_offset
+struct MipLevel{
+    int    width;
+    int    height;
+    int    tiles_x;
+    size_t tile_offset;
+};
+
+// Textures keep a full mip chain of 4x4 texel tiles, tiles in row-major
+// order. RGBA8 tiles store texels in Morton order, so a bilinear footprint
+// touches one or two cache lines. BC1/BC3 tiles are decoded on first use
+// into a small per-thread tile cache. Diffuse textures hold sRGB encoded
+// texels and are decoded to linear when sampled. Texture coordinates wrap,
+// v=0 is the bottom row of the image.
 class Texture{
+public:
+    static constexpr int TILE_SIZE=4;
+
 private:
-    int                  width;
-    int                  height;
-    int                  nrChannels;
-    std::string          file_path;
-    std::vector<color_t> data;
-    TextureType          type;
+    int                   width;
+    int                   height;
+    int                   nrChannels;
+    uint32_t              id;
+    std::string           file_path;
+    std::vector<uint32_t> words;
+    std::vector<MipLevel> levels;
+    TextureType           type;
+    TextureFormat         format;
+    TextureFilter         filter;
+    bool                  srgb;
+
+    void buildMipChain(std::vector<vec4f_t> data);
+
+    color_t  unpack(uint32_t texel) const;
+    uint32_t fetch(const MipLevel& level, int x, int y) const;
+    color_t  sampleNearest(const MipLevel& level, float u, float v) const;
+    color_t  sampleBilinear(const MipLevel& level, float u, float v) const;
 
 public:
-    Texture(std::string file_path, TextureType type);
+    Texture(std::string file_path, TextureType type, TextureFormat format=TextureFormat::RGBA8);
+    Texture(int width, int height, std::vector<color_t> data, TextureType type, TextureFormat format=TextureFormat::RGBA8);
 
     int getWidth() const      {return width;}
     int getHeight() const     {return height;}
     int getNrChannels() const {return nrChannels;}
+    int getLevelCount() const {return static_cast<int>(levels.size());}
 
     std::string          getFilePath() const        {return file_path;}
-    std::vector<color_t> getTextureData() const     {return data;}
+    std::vector<color_t> getTextureData() const;
+    size_t               getMemorySize() const      {return words.size()*sizeof(uint32_t);}
     TextureType          getTextureType() const     {return type;}
+    TextureFormat        getFormat() const          {return format;}
+    bool                 isSrgb() const             {return srgb;}
+    TextureFilter        getFilter() const          {return filter;}
+    void                 setFilter(TextureFilter filter) {this->filter=filter;}
+
+    // level of detail for uv derivatives per screen pixel
+    float getLod(const vec2f_t& duv_dx, const vec2f_t& duv_dy) const;
 
     color_t sample(float u, float v) const;
+    color_t sample(float u, float v, float lod) const;
+    color_t sample(const texcoord_t& uv, const vec2f_t& duv_dx, const vec2f_t& duv_dy) const;
 };
@@ -0,0 +1,38 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned count)
+: stopping(false)
+{
+    count=std::max(count, 1u);
+    for(unsigned i=0; i<count; i++)
+        workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping=true;
+    }
+    condition.notify_all();
+    for(auto& worker: workers)
+        worker.join();
+}
+
+void ThreadPool::work()
+{
+    while(true){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]{ return stopping || !tasks.empty(); });
+            if(tasks.empty())
+                return;
+            task=std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads running submitted tasks in FIFO order.
+// Destroying the pool finishes the queued tasks first.
+class ThreadPool{
+private:
+    std::vector<std::thread>          workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex                        mutex;
+    std::condition_variable           condition;
+    bool                              stopping;
+
+    void work();
+
+public:
+    explicit ThreadPool(unsigned count=std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&)=delete;
+    ThreadPool& operator=(const ThreadPool&)=delete;
+
+    size_t getWorkerCount() const {return workers.size();}
+
+    template<typename F>
+    auto submit(F&& f) -> std::future<std::invoke_result_t<F>>;
+};
+
+template<typename F>
+auto ThreadPool::submit(F&& f) -> std::future<std::invoke_result_t<F>>
+{
+    // std::function needs a copyable target, the task itself is move-only
+    auto task=std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(f));
+    auto future=task->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.emplace([task]{ (*task)(); });
+    }
+    condition.notify_one();
+    return future;
+}
@@ -1,14 +1,17 @@
 #include "Window.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <thread>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 #include "global.hpp"
-#include "Pipeline.hpp"
+#include "Profiler.hpp"
 
 Window::Window()
+: show_hud(false), export_profile(false), pbos{}, pbo_data{}, pbo_fences{}, in_flight{}, in_flight_count(0)
 {
     // initialize glfw
     glfwInit();
@@ -32,6 +35,8 @@ Window::Window()
     // set callback
     glfwSwapInterval(1);
     glfwSetFramebufferSizeCallback(this->window, frameBufferSizeCallback);
+    glfwSetWindowUserPointer(this->window, this);
+    glfwSetKeyCallback(this->window, keyCallback);
 
     createGlShader(PROJECT_PATH "/shaders/main.vs", PROJECT_PATH "/shaders/main.fs");
 }
@@ -39,8 +44,7 @@ Window::Window()
 Window::~Window()
 {
     // delte components
-    delete shader;
-    delete rasterizer;
+    delete context;
     delete model;
     delete camera;
 
@@ -59,27 +63,29 @@ void Window::setInitConfig()
 
     direct_t view_pos(960.f, 540.f, 3.0f);
     camera=new Camera(view_pos);
-    rasterizer=new Rasterizer(width, height);
-    shader=new Shader();
+    context=new RenderContext(width, height);
 
-    Pipeline::bind(camera);
-    Pipeline::bind(rasterizer);
-    Pipeline::bind(shader);
-    Pipeline::bind(model);
+    // the model matrix places the model in pixels already, the projection
+    // only maps depth to [0, 1] so that it can be clipped; smaller z stays closer
+    context->getShader().setProjection(Geometry::viewport(0.f, 0.f, width, height, 0.f, 1.f)
+        *Geometry::ortho(0.f, width, height, 0.f, 1000.f, -1000.f));
+
+    context->bind(camera);
+    context->add(*model);
 }
 
-void Window::setRenderConfig()
+void Window::setRenderConfig(const FrameInput& input)
 {
     // set model matrix
     matrix_t mat=matrix_t::Identity();
     mat=Geometry::translate(mat, direct_t(960.f, 875.f, 0.f));
-    mat=Geometry::scale(mat, direct_t(50.f, -50.f, 50.f));
-    mat=Geometry::rotate(mat, glfwGetTime(), direct_t(0.f, 1.f, 0.f));
-    shader->setModel(mat);
+    mat=Geometry::scale(mat, direct_t(50.f, -50.f, -50.f));
+    mat=Geometry::rotate(mat, input.time, direct_t(0.f, 1.f, 0.f));
+    context->getScene().front().model_mat=mat;
 
     // set view and projection matrix
-    // shader->setView(camera->getView());
-    // shader->setProjection(camera->getProjection());
+    // context->getShader().setView(camera->getView());
+    // context->getShader().setProjection(camera->getProjection());
 }
 
 void Window::run()
@@ -87,30 +93,73 @@ void Window::run()
     initialize();
     setInitConfig();
 
-    while(!glfwWindowShouldClose(window)){
-        double start=glfwGetTime();
-
-        Pipeline::clear({1.f, 1.f, 1.f});
-        Pipeline::render();
+    // every color target starts out free
+    std::thread render_thread(&Window::renderLoop, this);
+    for(int i=0; i<PBO_COUNT; i++)
+        requests.push({i, snapshotInput()});
 
-        setRenderConfig();
+    while(!glfwWindowShouldClose(window)){
+        glfwPollEvents();
         processInput();
+        recycleColorTargets();
+
+        int slot;
+        if(!ready.pop(slot)){
+            glfwWaitEventsTimeout(0.001);
+            continue;
+        }
 
         glUseProgram(window_shader);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT, rasterizer->getFramebufferData());
+        presentColorTarget(slot);
         glBindVertexArray(this->vao);
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
         glfwSwapBuffers(window);
-        glfwPollEvents();
-
-        double end=glfwGetTime();
-        std::cerr<<1.f/(end-start)<<"fps"<<std::endl;
     }
 
+    requests.push({-1, {}});
+    render_thread.join();
     release();
 }
 
+void Window::renderLoop()
+{
+    // owns the render context until it is asked to stop
+    while(true){
+        FrameRequest request;
+        requests.waitPop(request);
+        if(request.slot<0)
+            return;
+
+        Profiler::beginFrame();
+
+        context->getRasterizer().setColorTarget(pbo_data[request.slot]);
+        setRenderConfig(request.input);
+        context->clear({1.f, 1.f, 1.f});
+        context->render();
+        if(request.input.show_hud)
+            Profiler::drawOverlay(context->getRasterizer());
+
+        Profiler::endFrame();
+
+        if(request.input.export_profile){
+            if(Profiler::exportCsv(PROJECT_PATH "/profile.csv"))
+                std::cerr<<"Profile written to " PROJECT_PATH "/profile.csv"<<std::endl;
+            else
+                std::cerr<<"Failed to write " PROJECT_PATH "/profile.csv"<<std::endl;
+        }
+
+        ready.push(request.slot);
+    }
+}
+
+FrameInput Window::snapshotInput()
+{
+    FrameInput input{glfwGetTime(), show_hud, export_profile};
+    export_profile=false;
+    return input;
+}
+
 void Window::initialize()
 {
     float vertices[]={
@@ -141,22 +190,97 @@ void Window::initialize()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    // immutable storage, the rasterizer output is already sRGB encoded and
+    // passes through the window shader unchanged
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+
+    // ring of persistently mapped upload buffers
+    GLsizeiptr size=static_cast<GLsizeiptr>(width)*height*sizeof(uint32_t);
+    GLbitfield flags=GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+    glGenBuffers(PBO_COUNT, pbos);
+    for(int i=0; i<PBO_COUNT; i++){
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+        pbo_data[i]=static_cast<uint32_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+        if(pbo_data[i]==nullptr){
+            std::cerr<<"Failed to map pixel buffer"<<std::endl;
+            exit(-1);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
     glUseProgram(window_shader);
     glUniform1i(glGetUniformLocation(window_shader, "texture0"), 0);
 }
 
 void Window::release()
 {
+    context->getRasterizer().setColorTarget(nullptr);
+    for(int i=0; i<PBO_COUNT; i++){
+        if(pbo_fences[i])
+            glDeleteSync(pbo_fences[i]);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(PBO_COUNT, pbos);
+    glDeleteTextures(1, &window_texture);
+
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &vbo);
 }
 
+void Window::recycleColorTargets()
+{
+    // targets are handed back in presentation order once the gpu copied them
+    while(in_flight_count>0){
+        int slot=in_flight[0];
+        GLenum status=glClientWaitSync(pbo_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if(status!=GL_ALREADY_SIGNALED && status!=GL_CONDITION_SATISFIED)
+            return;
+
+        glDeleteSync(pbo_fences[slot]);
+        pbo_fences[slot]=nullptr;
+        std::copy(in_flight+1, in_flight+in_flight_count, in_flight);
+        in_flight_count--;
+        requests.push({slot, snapshotInput()});
+    }
+}
+
+void Window::presentColorTarget(int slot)
+{
+    ProfileScope scope(ProfileStage::UPLOAD);
+
+    // copy from the mapped buffer happens on the gpu timeline
+    glBindTexture(GL_TEXTURE_2D, window_texture);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[slot]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    pbo_fences[slot]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    in_flight[in_flight_count++]=slot;
+}
+
 void Window::processInput()
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 }
 
+void Window::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if(action!=GLFW_PRESS)
+        return;
+
+    // F1 toggles the profiler overlay, F2 dumps the frame history
+    // both are picked up by the next frame snapshot
+    auto self=static_cast<Window*>(glfwGetWindowUserPointer(window));
+    if(key==GLFW_KEY_F1)
+        self->show_hud=!self->show_hud;
+    else if(key==GLFW_KEY_F2)
+        self->export_profile=true;
+}
+
 void Window::frameBufferSizeCallback(GLFWwindow *window, int width, int height)
 {
     glViewport(0, 0, width, height);
@@ -1,25 +1,59 @@
 #pragma once
 
+#include <cstdint>
+
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 #include "Camera.hpp"
-#include "Rasterizer.hpp"
-#include "Shader.hpp"
+#include "RenderContext.hpp"
+#include "SpscQueue.hpp"
+
+// everything the render thread reads for one frame, copied on the gl thread
+struct FrameInput{
+    double time;
+    bool   show_hud;
+    bool   export_profile;
+};
+
+struct FrameRequest{
+    int        slot;    // color target to draw into, -1 stops the render thread
+    FrameInput input;
+};
 
 class Window{
 private:
+    // frames in flight between the rasterizer and the gpu
+    static constexpr int PBO_COUNT=3;
+
     int width, height;
     unsigned int vao, vbo, window_texture, window_shader;
+    bool show_hud;
+    bool export_profile;
+
+    // persistently mapped upload buffers, the rasterizer draws into them
+    unsigned int pbos[PBO_COUNT];
+    uint32_t*    pbo_data[PBO_COUNT];
+    GLsync       pbo_fences[PBO_COUNT];
+
+    // frames are rendered on a worker while the gl thread presents: free
+    // targets go out as requests, finished ones come back as ready slots
+    SpscQueue<FrameRequest, 4> requests;
+    SpscQueue<int, 4>          ready;
+    int                        in_flight[PBO_COUNT];
+    int                        in_flight_count;
 
-    GLFWwindow* window;
-    Camera*     camera;
-    Model*      model;
-    Rasterizer* rasterizer;
-    Shader*     shader;
+    GLFWwindow*    window;
+    Camera*        camera;
+    Model*         model;
+    RenderContext* context;
 
     void initialize();
     void release();
+    void renderLoop();
+    FrameInput snapshotInput();
+    void recycleColorTargets();
+    void presentColorTarget(int slot);
     void processInput();
     void createGlShader(const char* vertex_path, const char* fragment_path);
     void checkGlShader(unsigned int shader, std::string type);
@@ -28,6 +62,7 @@ private:
     static void frameBufferSizeCallback(GLFWwindow *window, int width, int height);
     static void mouseButtonCallback(GLFWwindow* window, int button, int state, int mod);
     static void cursorPosCallback(GLFWwindow* window, double xpos, double ypos);
+    static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
 public:
     Window();
@@ -37,6 +72,6 @@ public:
     int getHeight() {return height;}
 
     void setInitConfig();
-    void setRenderConfig();
+    void setRenderConfig(const FrameInput& input);
     void run();
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <limits>
 #include <eigen3/Eigen/Eigen>
 
 const int SCR_WIDTH=1920, SCR_HEIGHT=1080;
@@ -17,16 +18,22 @@ using vec3f_t    = Eigen::Vector3f;
 using vec4f_t    = Eigen::Vector4f;
 using line_t     = std::array<vertex_t, 2>;
 
-using triangle_t = struct {
+struct triangle_t{
     std::array<vertex_t, 3>   vertices;
     std::array<normal_t, 3>   normals;
-    std::array<texcoord_t, 2> texcoords;
+    std::array<texcoord_t, 3> texcoords;
     std::array<color_t, 3>    colors;
 };
 
-using light_t = struct {
-    vec3f_t position;
-    vec3f_t intensity;
+class ShadowMap;
+
+// point light with inverse-square falloff, faded out to nothing at radius
+struct light_t{
+    vec3f_t          position;
+    vec3f_t          intensity;
+    float            radius=std::numeric_limits<float>::infinity();
+    // depth seen from the light, null when it casts no shadows
+    const ShadowMap* shadow_map=nullptr;
 };
 
 #ifdef DEBUG
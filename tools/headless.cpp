@@ -0,0 +1,442 @@
+// Offscreen driver: renders a model through RenderContext without any window or
+// GL context, so it runs on machines without a display and is not capped by
+// vsync.
+//
+//   rasterizer_headless <model.obj> [--width W] [--height H] [--frames N]
+//                       [--camera path.txt] [--output dir] [--csv profile.csv] [--hud]
+//                       [--deferred] [--msaa 1|2|4|8]
+//                       [--texture-format rgba8|bc1|bc3] [--lights N] [--shadow SIZE]
+//                       [--instances N] [--views N] [--lod-error PIXELS]
+//
+// A camera path has one keyframe per line, "x y z yaw pitch"; frames are
+// spread evenly over the keyframes. Without a camera path the model spins in
+// front of the screen like in the window. Frames are written as PPM when an
+// output directory is given and discarded otherwise. --csv exports the
+// per-stage profile of the last frames, --hud draws it into written frames.
+// --deferred writes a G-buffer first and then shades every visible pixel once.
+// --msaa tests coverage and depth per sample and shades once per pixel and
+// triangle; it only applies to forward shading and is ignored with --deferred.
+// --texture-format picks the in-memory format of the model's textures.
+// --lights scatters N colored point lights through the model's bounds, the
+// same ones every run. --shadow adds a key light above the model that casts
+// shadows through a SIZE x SIZE shadow map rendered every frame.
+// --instances draws N tinted copies of the model on a square grid in one
+// instanced draw. --views renders N views of the same model per frame, each
+// with its own context on its own thread: turned further by 1/N of a spin or
+// started 1/N further along the camera path, and written as
+// frame_NNNNN_view_KK.ppm. --lod-error is the screen-space error in pixels
+// a simplified level of detail may add, 0 always draws full detail.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Geometry.hpp"
+#include "RenderContext.hpp"
+#include "Profiler.hpp"
+
+struct Keyframe{
+    direct_t position;
+    float    yaw;
+    float    pitch;
+};
+
+struct Options{
+    std::string           model_path;
+    std::string           camera_path;
+    std::string           output_dir;
+    std::string           csv_path;
+    bool                  hud=false;
+    bool                  deferred=false;
+    int                   samples=1;
+    int                   lights=0;
+    int                   shadow_size=0;
+    int                   instances=0;
+    int                   views=1;
+    float                 lod_error=1.f;
+    TextureFormat         texture_format=TextureFormat::RGBA8;
+    int                   width=SCR_WIDTH;
+    int                   height=SCR_HEIGHT;
+    int                   frames=100;
+};
+
+static void usage(const char* name)
+{
+    std::cerr<<"usage: "<<name<<" <model.obj> [--width W] [--height H] [--frames N]"
+        <<" [--camera path.txt] [--output dir] [--csv profile.csv] [--hud] [--deferred]"
+        <<" [--msaa 1|2|4|8] [--texture-format rgba8|bc1|bc3] [--lights N] [--shadow SIZE] [--instances N] [--views N] [--lod-error PIXELS]"<<std::endl;
+    exit(1);
+}
+
+static Options parseOptions(int argc, const char* argv[])
+{
+    Options options;
+    for(int i=1; i<argc; i++){
+        std::string arg=argv[i];
+        bool has_value=i+1<argc;
+        if(arg=="--width" && has_value)
+            options.width=std::stoi(argv[++i]);
+        else if(arg=="--height" && has_value)
+            options.height=std::stoi(argv[++i]);
+        else if(arg=="--frames" && has_value)
+            options.frames=std::stoi(argv[++i]);
+        else if(arg=="--camera" && has_value)
+            options.camera_path=argv[++i];
+        else if(arg=="--output" && has_value)
+            options.output_dir=argv[++i];
+        else if(arg=="--csv" && has_value)
+            options.csv_path=argv[++i];
+        else if(arg=="--hud")
+            options.hud=true;
+        else if(arg=="--deferred")
+            options.deferred=true;
+        else if(arg=="--msaa" && has_value){
+            options.samples=std::stoi(argv[++i]);
+            if(options.samples!=1 && options.samples!=2 && options.samples!=4 && options.samples!=8)
+                usage(argv[0]);
+        }
+        else if(arg=="--lights" && has_value)
+            options.lights=std::stoi(argv[++i]);
+        else if(arg=="--shadow" && has_value)
+            options.shadow_size=std::stoi(argv[++i]);
+        else if(arg=="--instances" && has_value)
+            options.instances=std::stoi(argv[++i]);
+        else if(arg=="--views" && has_value)
+            options.views=std::stoi(argv[++i]);
+        else if(arg=="--lod-error" && has_value)
+            options.lod_error=std::stof(argv[++i]);
+        else if(arg=="--texture-format" && has_value){
+            std::string format=argv[++i];
+            if(format=="rgba8")
+                options.texture_format=TextureFormat::RGBA8;
+            else if(format=="bc1")
+                options.texture_format=TextureFormat::BC1;
+            else if(format=="bc3")
+                options.texture_format=TextureFormat::BC3;
+            else
+                usage(argv[0]);
+        }
+        else if(arg[0]!='-' && options.model_path.empty())
+            options.model_path=arg;
+        else
+            usage(argv[0]);
+    }
+
+    if(options.model_path.empty() || options.width<=0 || options.height<=0 || options.frames<=0 || options.lights<0 || options.shadow_size<0 || options.instances<0 || options.views<=0 || options.lod_error<0.f)
+        usage(argv[0]);
+    return options;
+}
+
+static std::vector<Keyframe> readCameraPath(const std::string& path)
+{
+    std::ifstream file(path);
+    if(!file){
+        std::cerr<<"Failed to open camera path "<<path<<std::endl;
+        exit(1);
+    }
+
+    std::vector<Keyframe> keyframes;
+    std::string line;
+    while(std::getline(file, line)){
+        if(line.empty() || line[0]=='#')
+            continue;
+        std::istringstream stream(line);
+        Keyframe key;
+        float x, y, z;
+        if(stream>>x>>y>>z>>key.yaw>>key.pitch){
+            key.position=direct_t(x, y, z);
+            keyframes.push_back(key);
+        }
+    }
+
+    if(keyframes.empty()){
+        std::cerr<<"Camera path "<<path<<" has no keyframes"<<std::endl;
+        exit(1);
+    }
+    return keyframes;
+}
+
+static Camera cameraAt(const std::vector<Keyframe>& keyframes, float t)
+{
+    // t in [0, 1] over the whole path
+    float pos=t*(keyframes.size()-1);
+    size_t i=std::min(static_cast<size_t>(pos), keyframes.size()-1);
+    size_t j=std::min(i+1, keyframes.size()-1);
+    float f=pos-i;
+
+    const auto& a=keyframes[i];
+    const auto& b=keyframes[j];
+    return Camera(a.position*(1-f)+b.position*f, direct_t(0.f, 1.f, 0.f),
+        a.yaw*(1-f)+b.yaw*f, a.pitch*(1-f)+b.pitch*f);
+}
+
+static void writeFrame(const std::string& path, const Rasterizer& rasterizer)
+{
+    FILE* file=fopen(path.c_str(), "wb");
+    if(file==nullptr){
+        std::cerr<<"Failed to write frame "<<path<<std::endl;
+        exit(1);
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", rasterizer.width, rasterizer.height);
+    // the color target is already sRGB encoded
+    std::vector<unsigned char> row(rasterizer.width*3);
+    for(int y=0; y<rasterizer.height; y++){
+        for(int x=0; x<rasterizer.width; x++){
+            uint32_t pixel=rasterizer.getPixel(x, y);
+            for(int k=0; k<3; k++)
+                row[x*3+k]=static_cast<unsigned char>(pixel>>(8*k));
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    fclose(file);
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t index=static_cast<size_t>(p*(sorted.size()-1)+0.5);
+    return sorted[std::min(index, sorted.size()-1)];
+}
+
+// world-space box of the mesh under mat
+static void worldBounds(const Mesh& mesh, const matrix_t& mat, vec3f_t& bounds_min, vec3f_t& bounds_max)
+{
+    bounds_min=vec3f_t::Constant(std::numeric_limits<float>::max());
+    bounds_max=vec3f_t::Constant(std::numeric_limits<float>::lowest());
+    for(const DrawRange& range: mesh.ranges){
+        for(int c=0; c<8; c++){
+            vec3f_t corner((c&1) ? range.bounds_max.x() : range.bounds_min.x(),
+                           (c&2) ? range.bounds_max.y() : range.bounds_min.y(),
+                           (c&4) ? range.bounds_max.z() : range.bounds_min.z());
+            vec3f_t world=(mat*corner.homogeneous()).hnormalized();
+            bounds_min=bounds_min.cwiseMin(world);
+            bounds_max=bounds_max.cwiseMax(world);
+        }
+    }
+}
+
+// lights with a fixed seed around the world-space box of the mesh under
+// mat, each reaching about an eighth of the box diagonal
+static std::vector<light_t> scatterLights(const Mesh& mesh, const matrix_t& mat, int count)
+{
+    std::vector<light_t> lights;
+    if(mesh.ranges.empty())
+        return lights;
+    vec3f_t bounds_min, bounds_max;
+    worldBounds(mesh, mat, bounds_min, bounds_max);
+    // a flat model still gets lights above and below it
+    float radius=(bounds_max-bounds_min).norm()/8.f;
+    bounds_min-=vec3f_t::Constant(radius/2.f);
+    bounds_max+=vec3f_t::Constant(radius/2.f);
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    for(int i=0; i<count; i++){
+        vec3f_t t(unit(rng), unit(rng), unit(rng));
+        vec3f_t color(0.2f+0.8f*unit(rng), 0.2f+0.8f*unit(rng), 0.2f+0.8f*unit(rng));
+        // bright enough to light the surface at half the radius
+        lights.push_back({bounds_min+t.cwiseProduct(bounds_max-bounds_min), color*radius*radius*0.25f, radius});
+    }
+    return lights;
+}
+
+// light two bounding radii above the model, its perspective frustum fits
+// the bounding sphere; up is toward smaller y in the spin's pixel space
+static light_t keyLight(const Mesh& mesh, const matrix_t& mat, bool y_down, ShadowMap& shadow_map)
+{
+    vec3f_t bounds_min, bounds_max;
+    worldBounds(mesh, mat, bounds_min, bounds_max);
+    vec3f_t center=(bounds_min+bounds_max)/2.f;
+    float radius=std::max((bounds_max-bounds_min).norm()/2.f, 1e-3f);
+
+    vec3f_t direction=vec3f_t(0.4f, y_down ? -0.8f : 0.8f, y_down ? -0.45f : 0.45f).normalized();
+    vec3f_t position=center+direction*radius*2.f;
+    // the sphere seen from twice its radius spans 30 degrees to each side
+    shadow_map.setLight(Geometry::lookAt(position, center, vec3f_t(0.f, 0.f, 1.f)),
+        Geometry::perspective(60.f, 1.f, radius, radius*3.f));
+
+    light_t light;
+    light.position=position;
+    light.intensity=vec3f_t::Constant(radius*radius*4.f);
+    light.shadow_map=&shadow_map;
+    return light;
+}
+
+// copies of the mesh on a square grid in its x-z plane, centered on the
+// original and spaced by one and a half box diagonals, with random tints
+static std::vector<Instance> gridInstances(const Mesh& mesh, int count)
+{
+    vec3f_t bounds_min, bounds_max;
+    worldBounds(mesh, matrix_t::Identity(), bounds_min, bounds_max);
+    float spacing=(bounds_max-bounds_min).norm()*1.5f;
+    int side=static_cast<int>(std::ceil(std::sqrt(static_cast<float>(count))));
+
+    std::vector<Instance> instances(count);
+    std::mt19937 rng(4321);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    for(int i=0; i<count; i++){
+        vec3f_t offset((i%side-(side-1)/2.f)*spacing, 0.f, (i/side-(side-1)/2.f)*spacing);
+        instances[i].model_mat=Geometry::translate(matrix_t::Identity(), offset);
+        instances[i].tint=vec3f_t(0.4f+0.6f*unit(rng), 0.4f+0.6f*unit(rng), 0.4f+0.6f*unit(rng));
+    }
+    return instances;
+}
+
+// one camera over the shared model, rendered by its own context; the
+// shadow map is written every frame, so each view has one
+struct View{
+    RenderContext context;
+    Camera        camera;
+    ShadowMap     shadow_map;
+
+    View(int width, int height, int shadow_size)
+    : context(width, height), shadow_map(std::max(shadow_size, 1)) {}
+};
+
+int main(int argc, const char* argv[])
+{
+    Options options=parseOptions(argc, argv);
+    std::vector<Keyframe> keyframes;
+    if(!options.camera_path.empty())
+        keyframes=readCameraPath(options.camera_path);
+
+    Model model(options.model_path, options.texture_format);
+    float w=static_cast<float>(options.width);
+    float h=static_cast<float>(options.height);
+    matrix_t viewport=Geometry::viewport(0.f, 0.f, w, h, 0.f, 1.f);
+
+    // same spin as the window, scaled to the output resolution
+    auto spin=[&](int frame, float angle){
+        float scale=50.f*h/SCR_HEIGHT;
+        matrix_t mat=matrix_t::Identity();
+        mat=Geometry::translate(mat, direct_t(w/2.f, h*875.f/SCR_HEIGHT, 0.f));
+        mat=Geometry::scale(mat, direct_t(scale, -scale, -scale));
+        return Geometry::rotate(mat, frame/60.f+angle, direct_t(0.f, 1.f, 0.f));
+    };
+    // the lights stay where the first frame puts the model
+    matrix_t light_mat=keyframes.empty() ? spin(0, 0.f) : matrix_t::Identity();
+    std::vector<light_t> scattered;
+    if(options.lights>0)
+        scattered=scatterLights(model.getMesh(), light_mat, options.lights);
+
+    // grid offsets in model space, placed by the model matrix every frame
+    std::vector<Instance> grid=gridInstances(model.getMesh(), options.instances);
+    auto place=[&](SceneObject& object, const matrix_t& mat){
+        object.model_mat=mat;
+        for(size_t i=0; i<grid.size(); i++)
+            object.instances[i].model_mat=mat*grid[i].model_mat;
+    };
+
+    std::vector<std::unique_ptr<View>> views;
+    for(int k=0; k<options.views; k++){
+        auto view=std::make_unique<View>(options.width, options.height, options.shadow_size);
+        RenderContext& context=view->context;
+        Rasterizer& rasterizer=context.getRasterizer();
+        Shader& shader=context.getShader();
+        if(options.deferred)
+            rasterizer.setShadingMode(ShadingMode::DEFERRED);
+        rasterizer.setSampleCount(options.samples);
+        shader.setLodError(options.lod_error);
+        context.bind(&view->camera);
+        context.add(model, grid);
+
+        // the spin places the model in pixels, its projection only maps depth
+        // to [0, 1] for clipping like the window does
+        if(keyframes.empty())
+            shader.setProjection(viewport*Geometry::ortho(0.f, w, h, 0.f, 1000.f, -1000.f));
+        std::vector<light_t> lights=scattered;
+        if(options.shadow_size>0)
+            lights.push_back(keyLight(model.getMesh(), light_mat, keyframes.empty(), view->shadow_map));
+        shader.setLights(lights);
+        views.push_back(std::move(view));
+    }
+
+    // views spread evenly over one turn of the spin or over the camera path
+    auto update=[&](View& view, int k, int frame){
+        float offset=static_cast<float>(k)/options.views;
+        SceneObject& object=view.context.getScene().front();
+        if(keyframes.empty()){
+            place(object, spin(frame, offset*2.f*float(M_PI)));
+        }else{
+            float t=options.frames>1 ? static_cast<float>(frame)/(options.frames-1) : 0.f;
+            t+=offset;
+            if(t>1.f)
+                t-=1.f;
+            view.camera=cameraAt(keyframes, t);
+            view.context.getShader().setView(view.camera.getView());
+            view.context.getShader().setProjection(viewport*view.camera.getProjection(w/h));
+        }
+    };
+
+    std::vector<double> frame_times;
+    frame_times.reserve(options.frames);
+    for(int frame=0; frame<options.frames; frame++){
+        for(int k=0; k<options.views; k++)
+            update(*views[k], k, frame);
+
+        Profiler::beginFrame();
+        auto start=std::chrono::steady_clock::now();
+        // one thread per view; the parallel loops inside each context run
+        // on that thread alone, since nested parallelism is off
+#pragma omp parallel for num_threads(options.views) schedule(static, 1)
+        for(int k=0; k<options.views; k++){
+            RenderContext& context=views[k]->context;
+            context.clear({1.f, 1.f, 1.f});
+            if(options.shadow_size>0)
+                context.renderShadow(views[k]->shadow_map);
+            context.render();
+        }
+        auto end=std::chrono::steady_clock::now();
+        Profiler::endFrame();
+        frame_times.push_back(std::chrono::duration<double, std::milli>(end-start).count());
+
+        if(!options.output_dir.empty()){
+            for(int k=0; k<options.views; k++){
+                Rasterizer& rasterizer=views[k]->context.getRasterizer();
+                if(options.hud)
+                    Profiler::drawOverlay(rasterizer);
+                char name[40];
+                if(options.views>1)
+                    snprintf(name, sizeof(name), "/frame_%05d_view_%02d.ppm", frame, k);
+                else
+                    snprintf(name, sizeof(name), "/frame_%05d.ppm", frame);
+                writeFrame(options.output_dir+name, rasterizer);
+            }
+        }
+    }
+
+    std::vector<double> sorted=frame_times;
+    std::sort(sorted.begin(), sorted.end());
+    double total=0;
+    for(double t: frame_times)
+        total+=t;
+
+    printf("frames  %d (%dx%d, %d view%s)\n", options.frames, options.width, options.height, options.views, options.views>1 ? "s" : "");
+    printf("mean    %.3f ms (%.1f fps)\n", total/frame_times.size(), 1000.0*frame_times.size()/total);
+    printf("min     %.3f ms\n", sorted.front());
+    printf("median  %.3f ms\n", percentile(sorted, 0.5));
+    printf("p95     %.3f ms\n", percentile(sorted, 0.95));
+    printf("p99     %.3f ms\n", percentile(sorted, 0.99));
+    printf("max     %.3f ms\n", sorted.back());
+
+    printf("\nstage medians over the last %d frames\n", Profiler::getFrameCount());
+    for(int s=0; s<Profiler::STAGE_COUNT; s++){
+        ProfileStage stage=static_cast<ProfileStage>(s);
+        printf("%-9s %.3f ms (p95 %.3f)\n", Profiler::getStageName(stage),
+            Profiler::getStagePercentile(stage, 0.5), Profiler::getStagePercentile(stage, 0.95));
+    }
+
+    if(!options.csv_path.empty() && !Profiler::exportCsv(options.csv_path)){
+        std::cerr<<"Failed to write "<<options.csv_path<<std::endl;
+        return 1;
+    }
+
+    return 0;
+}